@@ -0,0 +1,85 @@
+// Throughput of a compiled program when 1 in 10 records is bad, through the
+// throwing run() and through try_run(), with and without formatting messages
+#include "libwc.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <print>
+
+namespace
+{
+	using number_t = wc::program::number_t;
+
+	struct record_t {
+		std::vector<number_t> inputs;
+	};
+
+	// Every tenth record is bad, alternating between a division by zero
+	// and too few inputs for the function
+	std::vector<record_t> make_records(size_t count)
+	{
+		std::vector<record_t> records(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto x = static_cast<number_t>(i % 97 + 1);
+			if (i % 10 != 9)
+				records[i].inputs = {x, x / 2 + 1};
+			else if (i % 20 == 9)
+				records[i].inputs = {x, 0};
+			else
+				records[i].inputs = {x};
+		}
+		return records;
+	}
+
+	template<typename F>
+	void measure(std::string_view name, const std::vector<record_t>& records, F&& f)
+	{
+		size_t bad = 0;
+		const auto tp_start = std::chrono::steady_clock::now();
+		for (const auto& record : records)
+			bad += !f(record);
+		const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - tp_start).count();
+
+		std::println("{:<20} {:>12.0f} records/s {:>8.1f} ns/record {:>8} bad",
+					 name, records.size() / secs, secs * 1e9 / records.size(), bad);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+	wc::calculator calc;
+	calc.load("2 :ratio defun / end");
+	auto prog = calc.compile("@ratio 3 * 1 +");
+
+	const auto records = make_records(count);
+	std::vector<number_t> values;
+	size_t chars = 0;
+
+	measure("exceptions", records, [&](const record_t& record) {
+		try
+		{
+			prog.run(record.inputs, values);
+			return true;
+		}
+		catch (const wc::exception& e)
+		{
+			return false;
+		}
+	});
+
+	measure("expected", records, [&](const record_t& record) {
+		return prog.try_run(record.inputs, values).has_value();
+	});
+
+	measure("expected+message", records, [&](const record_t& record) {
+		auto done = prog.try_run(record.inputs, values);
+		if (!done)
+			chars += done.error().message().size();
+		return done.has_value();
+	});
+
+	return chars > 0 ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+// Nanoseconds per interpreter primitive, measured on the internals directly:
+// every operation handler with number operands, variable access, scopes,
+// calls, loop iterations, literals and name lookups. Each is warmed up, then
+// timed over repetitions of a calibrated batch on one pinned CPU
+#include "wc.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <print>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+
+namespace wc
+{
+	class microbench
+	{
+		using calc_t = wtf_calculator;
+
+		struct stats_t {
+			double median, min, mean, stddev;
+		};
+
+		unsigned repetitions;
+		std::chrono::nanoseconds batch_time;
+		std::string_view filter;
+
+		static double elapsed_ns(std::chrono::steady_clock::time_point since)
+		{
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - since).count();
+		}
+
+		// Runs body in batches sized to last batch_time each, after a warm-up
+		// batch, and gives the per-call figures over the repetitions
+		template<typename F>
+		stats_t measure(F&& body)
+		{
+			size_t iterations = 1;
+			while (true)
+			{
+				const auto tp_start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < iterations; i++)
+					body();
+				if (elapsed_ns(tp_start) >= batch_time.count() || iterations >= (size_t(1) << 32))
+					break;
+				iterations *= 2;
+			}
+
+			std::vector<double> samples(repetitions);
+			for (auto& sample : samples)
+			{
+				const auto tp_start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < iterations; i++)
+					body();
+				sample = elapsed_ns(tp_start) / iterations;
+			}
+
+			std::sort(samples.begin(), samples.end());
+			double sum = 0, squares = 0;
+			for (const auto s : samples)
+				sum += s;
+			const double mean = sum / samples.size();
+			for (const auto s : samples)
+				squares += (s - mean) * (s - mean);
+
+			return {samples[samples.size() / 2], samples.front(), mean, std::sqrt(squares / samples.size())};
+		}
+
+		// Net is the median less what the harness spends around the primitive
+		template<typename F>
+		void row(std::string_view name, double setup, F&& body)
+		{
+			if (!filter.empty() && name.find(filter) == std::string_view::npos)
+				return;
+
+			const auto s = measure(body);
+			std::println("{:<24} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f}",
+						 name, s.median, s.min, s.mean, s.stddev, std::max(0.0, s.median - setup));
+		}
+
+		// Figures worked out from other measurements have a median only
+		void derived(std::string_view name, double ns)
+		{
+			if (filter.empty() || name.find(filter) != std::string_view::npos)
+				std::println("{:<24} {:>10.2f} {:>10} {:>10} {:>10} {:>10.2f}", name, ns, "-", "-", "-", ns);
+		}
+
+		// For primitives timed through a compiled loop, per iteration of it
+		double loop_ns(calc_t& calc, std::string_view body, unsigned iterations)
+		{
+			auto code = calc.compile(std::format("{} times {} end-times", iterations, body));
+			verdict_t verdict;
+			if (!code || !calc.run(*code, "bench", &verdict))
+			{
+				std::println(stderr, "Cannot run '{}'", body);
+				std::exit(1);
+			}
+			calc.stack.clear();
+
+			return measure([&] {
+				(void)calc.run(*code, "bench", &verdict);
+				calc.stack.clear();
+			}).median / iterations;
+		}
+
+	public:
+		microbench(unsigned repetitions, std::chrono::nanoseconds batch_time, std::string_view filter)
+			:repetitions(repetitions), batch_time(batch_time), filter(filter)
+		{
+		}
+
+		void operations()
+		{
+			calc_t calc;
+			std::string printed;
+			calc.capture = &printed;
+
+			// Pushing the operands and clearing the stack, which every row below pays
+			constexpr calc_t::number_t operand = 0.5L;
+			std::array<double, 4> setup {};
+			for (unsigned arity = 0; arity < setup.size(); arity++)
+			{
+				setup[arity] = measure([&] {
+					for (unsigned i = 0; i < arity; i++)
+						calc.stack.push_back(operand);
+					calc.stack.clear();
+				}).median;
+			}
+			row("(operands and clear)", 0, [&] {
+				calc.stack.push_back(operand);
+				calc.stack.push_back(operand);
+				calc.stack.clear();
+			});
+
+			// Operations that stop the process or print pages are left out
+			constexpr std::array<std::string_view, 7> skipped {"help", "stack", "quit", "vars", "funcs", "loops",
+																"desc-loop"};
+			for (const auto& op : calc_t::all_operations())
+			{
+				if (op.name.starts_with('_') || op.effect != effect_kind::plain ||
+					std::find(skipped.begin(), skipped.end(), op.name) != skipped.end() ||
+					std::any_of(op.operands().begin(), op.operands().end(),
+								[](operand_type t) { return t != operand_type::number; }))
+					continue;
+
+				row(op.name, setup[op.arity], [&] {
+					for (unsigned i = 0; i < op.arity; i++)
+						calc.stack.push_back(operand);
+					(void)op.handler(&calc);
+					calc.stack.clear();
+					if (printed.size() > 4096)
+						printed.clear();
+				});
+			}
+		}
+
+		void variables()
+		{
+			calc_t calc;
+			calc.variables["x"] = 1;
+			const calc_t::variable_ref_t ref("x");
+			calc_t::number_t out = 0;
+
+			row("variable get", 0, [&] {
+				(void)calc.dereference_variable(ref, out);
+			});
+
+			calc.push_locals(calc_t::scope_type::function, "f");
+			std::get<1>(calc.variables_local.back())["y"] = 1;
+			calc.push_locals(calc_t::scope_type::loop, "times");
+			const calc_t::variable_ref_t local("y");
+			row("variable get (local)", 0, [&] {
+				(void)calc.dereference_variable(local, out);
+			});
+			calc.pop_locals("times");
+			calc.pop_locals("f");
+
+			const std::string name = "x";
+			const double setup = measure([&] {
+				calc.stack.push_back(out);
+				calc.stack.push_back(name);
+				calc.stack.clear();
+			}).median;
+			row("variable set", setup, [&] {
+				calc.stack.push_back(out);
+				calc.stack.push_back(name);
+				(void)calc_t::op_set(&calc);
+			});
+
+			row("scope push and pop", 0, [&] {
+				calc.push_locals(calc_t::scope_type::loop, name);
+				calc.pop_locals(name);
+			});
+		}
+
+		void code()
+		{
+			calc_t calc;
+			if (!calc.parse("1 :inc defun 1 + end"))
+			{
+				std::println(stderr, "Cannot define the function");
+				std::exit(1);
+			}
+
+			constexpr unsigned iterations = 10000;
+			const double empty = loop_ns(calc, "", iterations);
+			const double inline_add = loop_ns(calc, "1 1 + pop", iterations);
+			const double called_add = loop_ns(calc, "1 @inc pop", iterations);
+
+			// Both bodies push 1, add 1 and pop, one of them through @inc
+			derived("loop iteration", empty);
+			derived("function call", std::max(0.0, called_add - inline_add));
+
+			row("literal compile", 0, [&] {
+				(void)calc.compile("3.14159");
+			});
+
+			row("operation lookup", 0, [&] {
+				(void)calc_t::find_operation("swap");
+			});
+
+			const std::string inc = "inc";
+			row("function lookup", 0, [&] {
+				(void)calc.find_function(inc);
+			});
+		}
+	};
+}; // namespace wc
+
+namespace
+{
+	// Keeps the measurements on one core, off migrations between caches
+	void pin(int cpu)
+	{
+		if (cpu < 0)
+			cpu = sched_getcpu();
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == 0)
+			std::println("Pinned to CPU {}", cpu);
+		else
+			std::println(stderr, "Cannot pin to CPU {}, running unpinned", cpu);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned repetitions = 15;
+	long batch_us = 2000;
+	int cpu = -1;
+	std::string_view filter;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string_view arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::println(stderr, "Usage: {} [--repetitions N] [--batch-us N] [--cpu N] [--filter NAME]", argv[0]);
+			return 2;
+		}
+
+		if (arg == "--repetitions")
+			repetitions = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--batch-us")
+			batch_us = std::max(1l, std::strtol(argv[++i], nullptr, 10));
+		else if (arg == "--cpu")
+			cpu = std::atoi(argv[++i]);
+		else if (arg == "--filter")
+			filter = argv[++i];
+		else
+		{
+			std::println(stderr, "Unknown argument: '{}'", arg);
+			return 2;
+		}
+	}
+
+	pin(cpu);
+	std::println("{:<24} {:>10} {:>10} {:>10} {:>10} {:>10}", "ns per call", "median", "min", "mean", "stddev", "net");
+
+	wc::microbench bench(repetitions, std::chrono::microseconds(batch_us), filter);
+	bench.operations();
+	bench.variables();
+	bench.code();
+}
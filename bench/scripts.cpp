@@ -0,0 +1,246 @@
+// Throughput of scaled-up versions of the sample scripts in instructions per
+// second, with the peak RSS of each, written as JSON. Every workload is also
+// measured relative to a fixed C++ loop timed in the same process, which
+// makes it comparable across machines. Given a baseline of an earlier run,
+// fails when a workload got slower relative to that loop by more than the threshold
+#include "libwc.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <print>
+#include <regex>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+	struct workload_t {
+		std::string_view name, load, program;
+		// Iterations of the outer loop at --scale 1
+		unsigned iterations;
+	};
+
+	// Sample functions are loaded by their path, so this runs from the source root
+	constexpr std::array<workload_t, 6> workloads {{
+		{"times", "", "1 {} times 1 + end-times", 1000000},
+		{"deep_times", "", "0 {} times 50 times 10 times 1 + end-times end-times end-times", 2000},
+		{"montecarlo", "7 seed", "0 {} times rand 2 ^ rand 2 ^ + 1 <= + end-times", 250000},
+		{"det", ":samples/funcs/det.sc file", "0 {} times 2 -3 5 6 0 4 1 5 -7 @det3x3 + end-times", 50000},
+		{"quadratic", ":samples/funcs/quadratic.sc file", "0 {} times 1 -3 2 @quadratic-roots + + end-times", 50000},
+		{"taylor", ":samples/funcs/taylor.sc file", "0 {} times 0.7 30 @sin-flex + 0.7 30 @cos-flex + end-times", 2500}
+	}};
+
+	// Plain data, so that a child can hand it back through a pipe
+	struct measure_t {
+		uint64_t steps = 0;
+		double best_ns = 0, calibration_ns = 0;
+		long peak_rss_kb = 0;
+		bool failed = false;
+	};
+
+	// ns per iteration of a loop of dependent arithmetic and branches, which
+	// stands in for how fast the machine runs the interpreter
+	double calibrate(unsigned repetitions)
+	{
+		constexpr unsigned iterations = 1 << 22;
+		double best = 1e300;
+		for (unsigned r = 0; r <= repetitions; r++)
+		{
+			const auto tp_start = std::chrono::steady_clock::now();
+			long double x = 1;
+			uint64_t state = 88172645463325252ull;
+			for (unsigned i = 0; i < iterations; i++)
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				switch (state & 3)
+				{
+				case 0: x = x * 1.0000001L + 1; break;
+				case 1: x = x - 0.5L; break;
+				case 2: x = x / 1.0000002L; break;
+				default: x = -x; break;
+				}
+			}
+			const std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - tp_start;
+			volatile long double sink = x;
+			(void)sink;
+			// The first round warms up
+			if (r > 0)
+				best = std::min(best, ns.count() / iterations);
+		}
+		return best;
+	}
+
+	measure_t measure(const workload_t& workload, double scale, unsigned repetitions)
+	{
+		measure_t out;
+		out.calibration_ns = calibrate(repetitions);
+		try
+		{
+			wc::calculator calc;
+			if (!workload.load.empty())
+				calc.load(workload.load);
+
+			const auto iterations = std::max(1u, static_cast<unsigned>(workload.iterations * scale));
+			auto prog = calc.compile(std::vformat(workload.program, std::make_format_args(iterations)));
+
+			// The first run warms up caches and the allocator
+			std::vector<wc::program::number_t> values;
+			prog.run({}, values);
+
+			out.best_ns = 1e300;
+			for (unsigned i = 0; i < repetitions; i++)
+			{
+				const auto tp_start = std::chrono::steady_clock::now();
+				prog.run({}, values);
+				const std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - tp_start;
+				out.best_ns = std::min(out.best_ns, ns.count());
+			}
+			out.steps = prog.steps();
+		}
+		catch (const wc::exception& e)
+		{
+			std::println(stderr, "{}: {}", workload.name, e.what());
+			out.failed = true;
+		}
+
+		rusage usage {};
+		getrusage(RUSAGE_SELF, &usage);
+		out.peak_rss_kb = usage.ru_maxrss;
+		return out;
+	}
+
+	// Every workload runs in a child of its own, which makes its peak RSS its own
+	measure_t measure_apart(const workload_t& workload, double scale, unsigned repetitions)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+			return measure(workload, scale, repetitions);
+
+		const pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			const auto out = measure(workload, scale, repetitions);
+			const bool sent = write(fds[1], &out, sizeof(out)) == sizeof(out);
+			_exit(sent ? 0 : 1);
+		}
+		close(fds[1]);
+
+		measure_t out;
+		out.failed = pid < 0 || read(fds[0], &out, sizeof(out)) != sizeof(out);
+		close(fds[0]);
+		if (pid > 0)
+			waitpid(pid, nullptr, 0);
+		return out;
+	}
+
+	// Reads back the ns per instruction relative to the calibration loop of what
+	// this program wrote as JSON
+	std::map<std::string, double> read_baseline(const std::string& path)
+	{
+		std::map<std::string, double> baseline;
+		std::ifstream ifs(path);
+		if (!ifs.is_open())
+		{
+			std::println(stderr, "Cannot open the baseline '{}'", path);
+			std::exit(2);
+		}
+
+		const std::regex entry(R"re("name": "([^"]+)".*"relative": ([0-9.eE+-]+))re");
+		std::string line;
+		std::smatch match;
+		while (std::getline(ifs, line))
+			if (std::regex_search(line, match, entry))
+				baseline[match[1]] = std::strtod(match[2].str().c_str(), nullptr);
+		return baseline;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	double scale = 1, threshold = 10;
+	unsigned repetitions = 5;
+	std::string baseline_path, output_path;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string_view arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::println(stderr, "Usage: {} [--scale X] [--repetitions N] [--baseline FILE] "
+						 "[--threshold PERCENT] [--output FILE]", argv[0]);
+			return 2;
+		}
+
+		if (arg == "--scale")
+			scale = std::strtod(argv[++i], nullptr);
+		else if (arg == "--repetitions")
+			repetitions = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--baseline")
+			baseline_path = argv[++i];
+		else if (arg == "--threshold")
+			threshold = std::strtod(argv[++i], nullptr);
+		else if (arg == "--output")
+			output_path = argv[++i];
+		else
+		{
+			std::println(stderr, "Unknown argument: '{}'", arg);
+			return 2;
+		}
+	}
+
+	const auto baseline = baseline_path.empty() ? std::map<std::string, double> {} : read_baseline(baseline_path);
+
+	std::ostringstream json;
+	json << "{\n  \"workloads\": [";
+
+	bool failed = false;
+	size_t written = 0;
+	for (size_t i = 0; i < workloads.size(); i++)
+	{
+		const auto& workload = workloads[i];
+		const auto m = measure_apart(workload, scale, repetitions);
+		if (m.failed || m.steps == 0)
+		{
+			std::println(stderr, "{:<12} failed", workload.name);
+			failed = true;
+			continue;
+		}
+
+		const double ns_per_op = m.best_ns / m.steps, relative = ns_per_op / m.calibration_ns;
+		json << std::format("{}\n    {{\"name\": \"{}\", \"steps\": {}, \"ops_per_sec\": {:.0f}, "
+							"\"ns_per_op\": {:.3f}, \"calibration_ns\": {:.3f}, \"relative\": {:.4f}, "
+							"\"peak_rss_kb\": {}}}",
+							written++ ? "," : "", workload.name, m.steps, 1e9 / ns_per_op, ns_per_op,
+							m.calibration_ns, relative, m.peak_rss_kb);
+
+		const auto it = baseline.find(std::string(workload.name));
+		if (it == baseline.end())
+			continue;
+
+		const double change = 100 * (relative / it->second - 1);
+		const bool regressed = change > threshold;
+		std::println(stderr, "{:<12} {:>9.3f} ns/op, {:>8.4f} of the loop, baseline {:>8.4f}, {:>+7.1f}%{}",
+					 workload.name, ns_per_op, relative, it->second, change, regressed ? " REGRESSED" : "");
+		failed = failed || regressed;
+	}
+	json << "\n  ]\n}\n";
+
+	std::cout << json.str();
+	if (!output_path.empty())
+		std::ofstream(output_path) << json.str();
+
+	return failed ? 1 : 0;
+}
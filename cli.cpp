@@ -0,0 +1,952 @@
+#include "wc.hpp"
+
+#include <charconv>
+#include <set>
+#include <csignal>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <readline/readline.h>
+#include <readline/history.h>
+
+namespace wc
+{
+	namespace
+	{
+		// Lock-free, so that the handler may store to it
+		std::atomic<bool> interrupted = false;
+
+		void on_interrupt(int)
+		{
+			interrupted.store(true, std::memory_order_relaxed);
+		}
+
+		// Ctrl-C stops the line being evaluated instead of the whole session
+		struct interrupt_scope
+		{
+			struct sigaction old {};
+
+			interrupt_scope()
+			{
+				struct sigaction sa {};
+				sa.sa_handler = on_interrupt;
+				sigemptyset(&sa.sa_mask);
+				interrupted.store(false, std::memory_order_relaxed);
+				sigaction(SIGINT, &sa, &old);
+			}
+			~interrupt_scope() { sigaction(SIGINT, &old, nullptr); }
+		};
+
+		// Errors of watched files are shown and waited to be fixed; false when quitting
+		bool report_watched(const error& e, std::string_view where)
+		{
+			switch (e.type)
+			{
+			case wc::error_type::parse:
+			case wc::error_type::eval:
+			case wc::error_type::exec:
+			case wc::error_type::file:
+			case wc::error_type::limit:
+				break;
+			case wc::error_type::repl_quit:
+				return false;
+			default:
+				e.raise();
+			}
+			standard_output().flush();
+			std::println(stderr, "Error: {}: {}: {}", where, wc::error_type_str[static_cast<int>(e.type)], e.message());
+			return true;
+		}
+	}
+
+	void wtf_calculator::start(int argc, char** argv)
+	{
+		parse_arguments(argc, argv);
+	}
+
+	void wtf_calculator::show_help(char* name)
+	{
+		std::println(stderr, "{}: Wtf Calculator: Another RPN calculator\n"
+					 "\t-h, --help: Show this\n"
+					 "\t-e, --expr [EXPRESSION]: Calculates EXPRESSION\n"
+					 "\t-f, --file [FILE]: Read expressions from FILE\n"
+					 "\t-s, --stdin: Read expression from standard input until EOF\n"
+					 "\t-a, --async-io: Read and write --stdin on their own threads\n"
+					 "\t-b, --batch [PROGRAM]: Run PROGRAM once per line of numbers from standard input\n"
+					 "\t-i, --input [FILE]: Read the lines for --batch from FILE instead\n"
+					 "\t-j, --jobs [N]: Run --batch lines and ptimes loops on N threads\n"
+					 "\t--serve [SOCKET]: Serve sessions over the unix socket SOCKET one request at a time, "
+					 "so that a long one holds up the rest unless --max-steps or --timeout bounds it\n"
+					 "\t-c, --client [SOCKET]: Send standard input to SOCKET and print the replies\n"
+					 "\t-r, --repl: Start the REPL\n"
+					 "\t--watch: Once the files are read, run again what changes when one of them or a file "
+					 "they read is saved\n"
+					 "\t-p, --prefix: Use prefix notation\n"
+					 "\t-t, --time: Show runtime, and time spent parsing, compiling and executing\n"
+					 "\t--perf-counters [FILE]: Count cycles, instructions and misses per phase and tic/toc label "
+					 "into FILE as JSON, and show them with --time\n"
+					 "\t--profile [FILE]: Show time spent per operation, function and loop, and save it to FILE as JSON\n"
+					 "\t--sample [FILE]: Sample the functions and loops running and the lines they are on into FILE\n"
+					 "\t--sample-hz [N]: Take N samples per second of CPU time with --sample, 997 by default\n"
+					 "\t--max-memory [N]: Fail evaluating once the stacks, loops, functions and variables hold "
+					 "N bytes, with an optional K, M or G suffix\n"
+					 "\t--max-steps [N]: Fail evaluating a line or --batch record after N steps\n"
+					 "\t--timeout [SECONDS]: Fail evaluating a line or --batch record after SECONDS\n"
+					 "\t--raw-output: Print the numbers of top and --batch records as 8-byte doubles, NaN for none\n"
+					 "\t--trace [FILE]: Record what operations do into FILE, and FILE.N for worker N, as binary\n"
+					 "\t--decode-trace [FILE]: Print the records of FILE as --verbose would have\n"
+					 "\t-v, --verbose: Be verbose", name);
+	}
+
+	void wtf_calculator::parse_arguments(int argc, char** argv)
+	{
+		enum class work_type { expression, file, stdin };
+		struct _parsed_t {
+			std::list<std::pair<work_type, std::string_view>> work;
+			std::string_view batch_program, batch_input;
+			std::string_view serve_path, client_path, profile_path, sample_path, counters_path, trace_path, decode_path;
+			bool is_repl, is_watch = false;
+
+			bool *const is_time_ptr, *const is_prefix_ptr, *const is_verbose_ptr, *const is_async_io_ptr;
+			bool *const raw_output_ptr;
+			unsigned *const jobs_ptr, *const sample_hz_ptr;
+			uint64_t *const max_memory_ptr, *const max_steps_ptr;
+			std::chrono::nanoseconds *const timeout_ptr;
+			char **argv;
+
+			_parsed_t(wtf_calculator* ins, int argc, char** argv)
+				:is_repl(argc == 1),
+				 is_time_ptr(&ins->is_time), is_prefix_ptr(&ins->is_prefix),
+				 is_verbose_ptr(&ins->verbose), is_async_io_ptr(&ins->is_async_io), raw_output_ptr(&ins->raw_output),
+				 jobs_ptr(&ins->jobs), sample_hz_ptr(&ins->sample_hz), max_memory_ptr(&ins->max_memory),
+				 max_steps_ptr(&ins->max_steps), timeout_ptr(&ins->timeout), argv(argv)
+			{}
+		} parsed(this, argc, argv);
+
+		const std::array<std::tuple<std::string_view, int, void(*)(_parsed_t&, int)>, 25> arguments {{
+				{"help", 0, [](_parsed_t& p, int i) {
+					wtf_calculator::show_help(p.argv[0]);
+					WC_EXCEPTION(init_help, "");
+				}},
+				{"expr", 1, [](_parsed_t& p, int i) {
+					p.work.push_back({work_type::expression, std::string_view(p.argv[i+1])});
+				}},
+				{"file", 1, [](_parsed_t& p, int i) {
+					p.work.push_back({work_type::file, std::string_view(p.argv[i+1])});
+				}},
+				{"stdin", 0, [](_parsed_t& p, int i) {
+					p.work.push_back({work_type::stdin, ""});
+				}},
+				{"async-io", 0, [](_parsed_t& p, int i) {
+					*p.is_async_io_ptr = true;
+				}},
+				{"batch", 1, [](_parsed_t& p, int i) {
+					p.batch_program = p.argv[i+1];
+				}},
+				{"input", 1, [](_parsed_t& p, int i) {
+					p.batch_input = p.argv[i+1];
+				}},
+				{"jobs", 1, [](_parsed_t& p, int i) {
+					int jobs = 0;
+					try
+					{
+						jobs = std::stoi(p.argv[i+1]);
+					}
+					catch (const std::exception&) {}
+					if (jobs < 1)
+						WC_EXCEPTION(init, "Argument 'jobs' requires a positive number, not '{}'", p.argv[i+1]);
+					*p.jobs_ptr = jobs;
+				}},
+				{"serve", 1, [](_parsed_t& p, int i) {
+					p.serve_path = p.argv[i+1];
+				}},
+				{"client", 1, [](_parsed_t& p, int i) {
+					p.client_path = p.argv[i+1];
+				}},
+				{"repl", 0, [](_parsed_t& p, int i) {
+					p.is_repl = true;
+				}},
+				{"watch", 0, [](_parsed_t& p, int i) {
+					p.is_watch = true;
+				}},
+				{"prefix", 0, [](_parsed_t& p, int i) {
+					WC_STD_EXCEPTION("--prefix is currently broken");
+					*p.is_prefix_ptr = true;
+				}},
+				{"time", 0, [](_parsed_t& p, int i) {
+					*p.is_time_ptr = true;
+				}},
+				{"perf-counters", 1, [](_parsed_t& p, int i) {
+					p.counters_path = p.argv[i+1];
+				}},
+				{"profile", 1, [](_parsed_t& p, int i) {
+					p.profile_path = p.argv[i+1];
+				}},
+				{"sample", 1, [](_parsed_t& p, int i) {
+					p.sample_path = p.argv[i+1];
+				}},
+				{"sample-hz", 1, [](_parsed_t& p, int i) {
+					int hz = 0;
+					try
+					{
+						hz = std::stoi(p.argv[i+1]);
+					}
+					catch (const std::exception&) {}
+					if (hz < 1 || hz > 1000000)
+						WC_EXCEPTION(init, "Argument 'sample-hz' requires a number from 1 to 1000000, not '{}'",
+									 p.argv[i+1]);
+					*p.sample_hz_ptr = hz;
+				}},
+				{"max-memory", 1, [](_parsed_t& p, int i) {
+					// A number of bytes with an optional K, M or G suffix
+					const std::string_view arg = p.argv[i+1];
+					uint64_t bytes = 0;
+					auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), bytes);
+					const std::string_view suffix(end, arg.data() + arg.size());
+					const char unit = suffix.size() == 1 ? std::toupper(static_cast<unsigned char>(suffix[0])) : 0;
+					const auto shift = unit == 'K' ? 10 : unit == 'M' ? 20 : unit == 'G' ? 30 :
+						suffix.empty() ? 0 : -1;
+					if (ec != std::errc() || bytes == 0 || shift < 0)
+						WC_EXCEPTION(init, "Argument 'max-memory' requires a number of bytes like 512M, not '{}'",
+									 arg);
+					if (bytes > (SIZE_MAX >> shift))
+						WC_EXCEPTION(init, "Argument 'max-memory' of '{}' is more than can be addressed", arg);
+					*p.max_memory_ptr = bytes << shift;
+				}},
+				{"max-steps", 1, [](_parsed_t& p, int i) {
+					const std::string_view arg = p.argv[i+1];
+					uint64_t steps = 0;
+					auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), steps);
+					if (ec != std::errc() || end != arg.data() + arg.size() || steps == 0)
+						WC_EXCEPTION(init, "Argument 'max-steps' requires a positive number, not '{}'", arg);
+					*p.max_steps_ptr = steps;
+				}},
+				{"timeout", 1, [](_parsed_t& p, int i) {
+					double seconds = 0;
+					try
+					{
+						seconds = std::stod(p.argv[i+1]);
+					}
+					catch (const std::exception&) {}
+					if (!(seconds > 0) || seconds > 1e9)
+						WC_EXCEPTION(init, "Argument 'timeout' requires a positive number of seconds, not '{}'",
+									 p.argv[i+1]);
+					*p.timeout_ptr = std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::duration<double>(seconds));
+				}},
+				{"raw-output", 0, [](_parsed_t& p, int i) {
+					*p.raw_output_ptr = true;
+				}},
+				{"trace", 1, [](_parsed_t& p, int i) {
+					p.trace_path = p.argv[i+1];
+				}},
+				{"decode-trace", 1, [](_parsed_t& p, int i) {
+					p.decode_path = p.argv[i+1];
+				}},
+				{"verbose", 0, [](_parsed_t& p, int i) {
+					*p.is_verbose_ptr = true;
+				}}
+			}
+		};
+
+		const std::array<std::string_view, 12> long_only {"serve", "perf-counters", "profile", "sample", "sample-hz",
+														  "max-memory", "max-steps", "timeout", "raw-output", "trace",
+														  "decode-trace", "watch"};
+
+		std::list<std::pair<int, int>> todo;
+		for (int i=1; i < argc; i++)
+		{
+			const auto length = (int)std::strlen(argv[i]);
+
+			if (length > 2 && argv[i][0] == '-' && argv[i][1] == '-')
+			{
+				bool none = true;
+				const char* arg = &argv[i][2];
+
+				for (int k=0; k < (int)arguments.size(); k++)
+				{
+					const auto& [name, ops, _func] = arguments[k];
+					if (name == arg)
+					{
+						if (i+ops >= argc)
+							WC_EXCEPTION(init, "Argument '{}' requires {} operands but only {} "
+										 "are left", name, ops, argc-i-1);
+						todo.push_back({k, i});
+						i += ops;
+						none = false;
+						break;
+					}
+				}
+
+				if (none)
+					WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i]);
+			}
+			else if (length > 1 && argv[i][0] == '-')
+			{
+				for (int j=1; j < length; j++)
+				{
+					bool none = true;
+					const char arg = argv[i][j];
+
+					for (int k=0; k < (int)arguments.size(); k++)
+					{
+						const auto& [name, ops, _func] = arguments[k];
+						if (name[0] == arg &&
+							std::find(long_only.begin(), long_only.end(), name) == long_only.end())
+						{
+							if (ops > 0 && j != length-1)
+								WC_EXCEPTION(init, "Argument '{}' requiring non-zero operands should "
+											 "be at the end", name[0]);
+							if (i+ops >= argc)
+								WC_EXCEPTION(init, "Argument '{}' requires {} operands but only {} "
+											 "are left", name[0], ops, argc-i-1);
+							todo.push_back({k, i});
+							i += ops;
+							none = false;
+						}
+					}
+
+					if (none)
+						WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i][j]);
+				}
+			}
+			else
+			{
+				WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i]);
+			}
+		}
+		for (auto [k, i] : todo)
+		{
+			std::get<2>(arguments[k])(parsed, i);
+		}
+
+		timer = std::make_unique<timing>(is_time || !parsed.counters_path.empty());
+		track_memory = max_memory > 0;
+		if (!parsed.trace_path.empty())
+		{
+			trace_path = parsed.trace_path;
+			trace_out = std::make_shared<trace_ring>(trace_path);
+		}
+		update_tracing();
+		if (!parsed.counters_path.empty())
+		{
+			counters_path = parsed.counters_path;
+			timer->enable_counters();
+		}
+		if (!parsed.profile_path.empty())
+		{
+			profile_path = parsed.profile_path;
+			profile = std::make_unique<profiler>();
+		}
+		if (!parsed.sample_path.empty())
+		{
+			sample_path = parsed.sample_path;
+			sampling = std::make_unique<sampler>();
+			sampling->start(sample_hz);
+		}
+
+		if (parsed.is_watch)
+		{
+			if (std::none_of(parsed.work.begin(), parsed.work.end(),
+							 [](const auto& item) { return item.first == work_type::file; }))
+				WC_EXCEPTION(init, "Argument 'watch' requires argument 'file'");
+			watcher = std::make_unique<file_watch>();
+		}
+
+		unsigned expressions = 0;
+
+		for (const auto& [type, what] : parsed.work)
+		{
+			switch(type)
+			{
+			case work_type::expression:
+				location = {intern_source("<expr>"), ++expressions};
+				timer->begin_item(std::format("-e {}", expressions));
+				unwrap(parse(what));
+				break;
+			case work_type::file:
+			{
+				timer->begin_item(std::format("-f {}", what));
+				// A watched file is kept watching through its errors, to be fixed
+				auto done = file(what);
+				if (!done && watcher)
+				{
+					if (!report_watched(done.error(), what))
+						return;
+				}
+				else
+					unwrap(std::move(done));
+				break;
+			}
+			case work_type::stdin:
+				timer->begin_item("stdin");
+				if (is_async_io)
+					stream(stdin);
+				else
+					unwrap(file(std::cin, "<stdin>"));
+				break;
+			}
+			timer->end_item();
+		}
+		if (!parsed.batch_program.empty())
+		{
+			const auto program = unwrap(compile(parsed.batch_program));
+			if (!compile_loops.empty())
+			{
+				compile_loops.clear();
+				WC_EXCEPTION(parse, "The batch program has an unterminated loop");
+			}
+			unwrap(verify(program, frame_type::function));
+
+			std::ifstream ifs;
+			if (!parsed.batch_input.empty())
+			{
+				ifs.open(parsed.batch_input.data());
+				if (!ifs.is_open())
+					WC_EXCEPTION(file, "Cannot open file '{}'", parsed.batch_input);
+			}
+			auto& is = parsed.batch_input.empty() ? std::cin : ifs;
+
+			if (jobs > 1)
+				batch_parallel(program, is);
+			else
+				batch(program, is);
+		}
+		else if (!parsed.batch_input.empty())
+		{
+			WC_EXCEPTION(init, "Argument 'input' requires argument 'batch'");
+		}
+
+		if (!parsed.client_path.empty())
+			client(parsed.client_path);
+		if (!parsed.serve_path.empty())
+			serve(parsed.serve_path);
+		if (!parsed.decode_path.empty())
+			trace_ring::decode(std::string(parsed.decode_path), stdout);
+
+		if (watcher)
+			watch();
+
+		if (parsed.is_repl || (parsed.work.empty() && parsed.batch_program.empty() &&
+							   parsed.serve_path.empty() && parsed.client_path.empty() && parsed.decode_path.empty()))
+			repl();
+	}
+
+	bool wtf_calculator::batch_record(const stack_t& program, verdict_t& verdict, const std::string& line,
+									  size_t record, std::string& error)
+	{
+		stack.clear();
+		rng_stream = record;
+		rng.reseed(rng_seed, rng_stream);
+
+		result<> done;
+
+		const char* it = line.c_str();
+		while (done)
+		{
+			while (*it && (isspace(*it) || *it == ','))
+				it++;
+			if (!*it)
+				break;
+
+			char* end;
+			const number_t field = std::strtold(it, &end);
+			if (end == it)
+			{
+				const auto garbage = std::string_view(it).substr(0, std::strcspn(it, " \t,"));
+				done = WC_ERROR(parse, "Garbage field: '{}'", garbage);
+				break;
+			}
+
+			stack.push_back(field);
+			it = end;
+		}
+
+		if (done)
+			done = run(program, "batch", &verdict);
+
+		// Raw records stay one number each, NaN where there is none
+		if (done && !stack.empty())
+			op_top(this);
+		else if (raw_output)
+			print_number(NAN);
+		else if (done)
+			println_out("");
+		else
+		{
+			switch (done.error().type)
+			{
+			case wc::error_type::parse:
+			case wc::error_type::eval:
+			case wc::error_type::exec:
+			case wc::error_type::file:
+			case wc::error_type::limit:
+				break;
+			case wc::error_type::repl_quit:
+				return false;
+			default:
+				done.error().raise();
+			}
+			error = std::format("Error: record {}: {}: {}", record,
+								wc::error_type_str[static_cast<int>(done.error().type)], done.error().message());
+			if (!raw_output)
+				println_out("");
+		}
+
+		return true;
+	}
+
+	void wtf_calculator::batch(const stack_t& program, std::istream& is)
+	{
+		std::string line, error;
+		size_t record = 0;
+		verdict_t verdict;
+
+		while (std::getline(is, line))
+		{
+			error.clear();
+			const bool more = batch_record(program, verdict, line, ++record, error);
+
+			if (!error.empty())
+				std::println(stderr, "{}", error);
+			if (!more)
+				break;
+		}
+	}
+
+	void wtf_calculator::batch_parallel(const stack_t& program, std::istream& is)
+	{
+		constexpr size_t window = 1 << 16, chunk = 256;
+
+		struct result_t {
+			std::string output, error;
+			bool quit = false;
+		};
+
+		auto& pool = prepare_workers();
+		std::vector<verdict_t> verdicts(pool.size());
+
+		std::vector<std::string> lines;
+		std::vector<result_t> results;
+		size_t first_record = 1;
+		bool quit = false;
+
+		while (!quit)
+		{
+			lines.clear();
+			std::string line;
+			while (lines.size() < window && std::getline(is, line))
+				lines.push_back(std::move(line));
+			if (lines.empty())
+				break;
+
+			results.assign(lines.size(), {});
+			std::atomic<size_t> quit_at = lines.size();
+
+			pool.parallel_for(lines.size(), chunk, [&](unsigned worker, size_t begin, size_t end) {
+				auto& ins = *pool_workers[worker];
+				for (size_t i = begin; i < end && i < quit_at.load(std::memory_order_relaxed); i++)
+				{
+					auto& result = results[i];
+
+					ins.capture = &result.output;
+					result.quit = !ins.batch_record(program, verdicts[worker], lines[i], first_record + i,
+													result.error);
+					ins.capture = nullptr;
+
+					size_t current = quit_at.load(std::memory_order_relaxed);
+					while (result.quit && i < current && !quit_at.compare_exchange_weak(current, i));
+				}
+			});
+
+			for (size_t i = 0; i < lines.size() && !quit; i++)
+			{
+				const auto& result = results[i];
+
+				if (!result.error.empty())
+					std::println(stderr, "{}", result.error);
+				print_out("{}", result.output);
+				quit = result.quit;
+			}
+
+			for (auto& worker : pool_workers)
+			{
+				if (profile)
+					profile->merge(*worker->profile);
+				if (timer)
+					timer->merge(*worker->timer);
+			}
+
+			first_record += lines.size();
+		}
+	}
+
+	void wtf_calculator::stream(std::FILE* in)
+	{
+		constexpr size_t block_size = 1 << 20, output_block_size = 1 << 16, depth = 8;
+
+		spsc_ring<std::string> ring_in(depth), ring_out(depth);
+		uint64_t bytes_in = 0, bytes_out = 0, records = 0;
+		const auto tp_start = std::chrono::steady_clock::now();
+
+		// What earlier work items printed goes first
+		standard_output().flush();
+
+		// The reader waits on the input and on this pipe, which finish() writes to
+		// so that an error or a limit does not wait for more input to arrive
+		int wake[2];
+		if (pipe2(wake, O_CLOEXEC) != 0)
+			WC_EXCEPTION(init, "Cannot create a pipe: {}", std::strerror(errno));
+
+		// Reads until size bytes, the end of the input or a wake up
+		const int fd = fileno(in);
+		auto read_block = [&](char* to, size_t size) {
+			size_t got = 0;
+			while (got < size)
+			{
+				pollfd pfds[2] {{fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+				if (poll(pfds, 2, -1) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+				if (pfds[1].revents)
+					break;
+
+				const auto n = read(fd, to + got, size - got);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					break;
+				got += n;
+			}
+			return got;
+		};
+
+		// Blocks always end at a newline; the remainder is carried into the next one
+		std::thread reader([&] {
+			std::string carry;
+			while (true)
+			{
+				std::string block = std::move(carry);
+				carry.clear();
+
+				const auto carried = block.size();
+				block.resize(carried + block_size);
+				const auto got = read_block(block.data() + carried, block_size);
+				block.resize(carried + got);
+				bytes_in += got;
+
+				if (got == 0)
+				{
+					if (!block.empty())
+						ring_in.push(std::move(block));
+					break;
+				}
+
+				const auto last = block.rfind('\n');
+				if (last == std::string::npos)
+				{
+					carry = std::move(block);
+					continue;
+				}
+
+				carry = block.substr(last + 1);
+				block.resize(last + 1);
+				if (!ring_in.push(std::move(block)))
+					break;
+			}
+			ring_in.close_producer();
+		});
+
+		std::thread writer([&] {
+			std::string block;
+			while (ring_out.pop(block))
+				bytes_out += std::fwrite(block.data(), 1, block.size(), stdout);
+			std::fflush(stdout);
+		});
+
+		auto finish = [&](std::string& output) {
+			capture = nullptr;
+			ring_in.close_consumer();
+			(void)!write(wake[1], "", 1);
+			ring_out.push(std::move(output));
+			ring_out.close_producer();
+			reader.join();
+			writer.join();
+			close(wake[0]);
+			close(wake[1]);
+		};
+
+		std::string block, output;
+		const auto source = intern_source("<stdin>");
+		capture = &output;
+		try
+		{
+			while (ring_in.pop(block))
+			{
+				std::string_view lines = block;
+				while (!lines.empty())
+				{
+					const auto line = lines.substr(0, lines.find('\n'));
+					lines.remove_prefix(std::min(lines.size(), line.size() + 1));
+
+					location = {source, (unsigned)++records};
+					unwrap(parse(line));
+
+					if (output.size() >= output_block_size)
+					{
+						ring_out.push(std::move(output));
+						output.clear();
+					}
+				}
+			}
+		}
+		catch (...)
+		{
+			finish(output);
+			throw;
+		}
+		finish(output);
+
+		if (is_time)
+		{
+			const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - tp_start).count();
+			std::println(stderr, "Stream: {} records, {} bytes in, {} bytes out, {:.0f} records/s, {:.1f} MiB/s in; "
+						 "waits: reader {}, evaluator {} in and {} out, writer {}",
+						 records, bytes_in, bytes_out, records / secs, bytes_in / secs / (1 << 20),
+						 ring_in.producer_waits, ring_in.consumer_waits, ring_out.producer_waits,
+						 ring_out.consumer_waits);
+		}
+	}
+
+	void wtf_calculator::repl()
+	{
+		auto cleanup_local = [](char*& what) {
+			if (what)
+			{
+				free(what);
+				what = nullptr;
+			}
+		};
+
+		using_history();
+
+		const auto source = intern_source("<repl>");
+		unsigned lines = 0;
+
+		// The stack from before the line, for one stopped by Ctrl-C or a budget to leave no half results
+		stack_t before;
+		interrupt = &interrupted;
+		auto evaluate_line = [&](std::string_view what) {
+			location = {source, ++lines};
+			before = stack;
+			interrupt_scope scope;
+			unwrap(parse(what));
+		};
+
+		bool quit = false;
+		while (!quit)
+		{
+			try
+			{
+#ifdef WC_USE_TRADITIONAL_GETLINE
+				std::string what_alt;
+
+				print_out("{}>> ", stack.size());
+				standard_output().flush();
+				if (!std::getline(std::cin, what_alt))
+					WC_EXCEPTION(repl_quit, "");
+
+				if (what_alt.size() > 0)
+					evaluate_line(what_alt);
+#else
+				char* what = nullptr;
+				try
+				{
+					auto prompt = std::format("{}>> ", stack.size());
+
+					standard_output().flush();
+					what = readline(prompt.c_str());
+					if (!what)
+						WC_EXCEPTION(repl_quit, "");
+
+					if (*what)
+					{
+						add_history(what);
+						evaluate_line(what);
+					}
+				}
+				catch (...)
+				{
+					cleanup_local(what);
+					throw;
+				}
+				cleanup_local(what);
+#endif
+
+				if (stack.size() > 0)
+				{
+					print_out("^");
+					op_top(this);
+				}
+			}
+			catch (const wc::exception& e)
+			{
+				switch (e.type)
+				{
+				case wc::error_type::parse:
+				case wc::error_type::eval:
+				case wc::error_type::exec:
+				case wc::error_type::file:
+					break;
+				case wc::error_type::limit:
+					stack = std::move(before);
+					break;
+				case wc::error_type::repl_quit:
+					quit = true;
+					continue;
+				default:
+					throw;
+				}
+				standard_output().flush();
+				std::println(stderr, "Error: {}: {}", wc::error_type_str[static_cast<int>(e.type)], e.what());
+			}
+		}
+
+#ifndef WC_USE_TRADITIONAL_GETLINE
+		rl_clear_history();
+#endif
+	}
+
+	// Runs again what saving the files changed: the statements of a file that
+	// are new or were edited, in order, then the statements of every watched
+	// file calling a function one of those defined
+	void wtf_calculator::watch()
+	{
+		while (true)
+		{
+			standard_output().flush();
+			const auto changed = watcher->wait();
+			if (changed.empty())
+				return;
+
+			// A statement cut short by an error may have left a definition or a loop open
+			if (!current_eval_function.empty())
+			{
+				functions.erase(current_eval_function);
+				current_eval_function.clear();
+			}
+			compile_loops.clear();
+
+			std::unordered_set<std::string> redefined;
+			std::set<std::pair<size_t, size_t>> ran;
+			size_t edited = 0, dependents = 0, failed = 0;
+
+			auto run_watched = [&](size_t file, size_t index) {
+				const auto statement = watched[file].statements[index];
+				const auto done = run_statement(statement, intern_source(watched[file].name));
+				// Running it may have read the file again
+				if (index < watched[file].statements.size())
+					watched[file].statements[index].done = done.has_value();
+				ran.insert({file, index});
+				if (!done)
+				{
+					failed++;
+					return report_watched(done.error(), std::format("{}:{}", watched[file].name, statement.line));
+				}
+				return true;
+			};
+
+			for (const auto& path : changed)
+			{
+				const auto it = std::find_if(watched.begin(), watched.end(), [&](const auto& w) { return w.path == path; });
+				const size_t file = it - watched.begin();
+				if (it == watched.end())
+					continue;
+
+				std::ifstream ifs(path);
+				if (!ifs.is_open())
+				{
+					report_watched(WC_ERROR(file, "Cannot open file '{}'", path).error(), watched[file].name);
+					continue;
+				}
+				auto fresh = split_statements(ifs);
+
+				// Statements match by their instructions, so that moving one or
+				// editing its comments does not run it again
+				std::unordered_map<std::string, unsigned> kept;
+				for (const auto& statement : watched[file].statements)
+				{
+					if (statement.done)
+						kept[statement.key]++;
+				}
+				std::vector<size_t> edits;
+				for (size_t i = 0; i < fresh.size(); i++)
+				{
+					auto match = kept.find(fresh[i].key);
+					if (match != kept.end() && match->second > 0)
+					{
+						match->second--;
+						fresh[i].done = true;
+					}
+					else
+					{
+						edits.push_back(i);
+						redefined.insert(fresh[i].defines.begin(), fresh[i].defines.end());
+					}
+				}
+				// What removed or edited statements defined may be called still
+				for (const auto& statement : watched[file].statements)
+				{
+					auto match = kept.find(statement.key);
+					if (statement.done && match != kept.end() && match->second > 0)
+					{
+						match->second--;
+						redefined.insert(statement.defines.begin(), statement.defines.end());
+					}
+				}
+
+				watched[file].statements = std::move(fresh);
+				for (const auto index : edits)
+				{
+					if (index >= watched[file].statements.size())
+						break;
+					edited++;
+					if (!run_watched(file, index))
+						return;
+				}
+			}
+
+			// Statements depending on what changed, and those an error kept from running before
+			for (size_t file = 0; file < watched.size(); file++)
+			{
+				for (size_t index = 0; index < watched[file].statements.size(); index++)
+				{
+					const auto& statement = watched[file].statements[index];
+					if (ran.contains({file, index}))
+						continue;
+					if (statement.done)
+					{
+						if (!statement.defines.empty() || redefined.empty())
+							continue;
+						const auto reached = callees(statement.calls);
+						if (std::none_of(reached.begin(), reached.end(),
+										 [&](const auto& name) { return redefined.contains(name); }))
+							continue;
+					}
+					dependents++;
+					if (!run_watched(file, index))
+						return;
+				}
+			}
+
+			standard_output().flush();
+			std::println(stderr, "Watch: {} statements edited, {} depending on them run again, {} failed",
+						 edited, dependents, failed);
+		}
+	}
+}; // namespace wc
@@ -0,0 +1,102 @@
+#include "libwc.hpp"
+#include "wc.hpp"
+
+namespace wc
+{
+	program::program(std::shared_ptr<const wtf_calculator> library)
+		:library(std::move(library)), session(new wtf_calculator(this->library.get()))
+	{
+		session->rng.reseed(session->rng_seed, session->rng_stream);
+	}
+
+	program::program(program&&) noexcept = default;
+	program& program::operator=(program&&) noexcept = default;
+	program::~program() = default;
+
+	std::vector<program::number_t> program::run(std::span<const number_t> inputs)
+	{
+		std::vector<number_t> values;
+		run(inputs, values);
+		return values;
+	}
+
+	void program::run(std::span<const number_t> inputs, std::vector<number_t>& values)
+	{
+		unwrap(try_run(inputs, values));
+	}
+
+	result<> program::try_run(std::span<const number_t> inputs, std::vector<number_t>& values)
+	{
+		printed.clear();
+		session->capture = &printed;
+		session->steps = 0;
+		session->rng_stream = runs++;
+		session->rng.reseed(session->rng_seed, session->rng_stream);
+		session->stack.clear();
+		for (const auto input : inputs)
+			session->stack.push_back(input);
+
+		auto done = session->run(code, "program", &verdict);
+		session->capture = nullptr;
+
+		values.clear();
+		if (!done)
+			return done;
+
+		for (const auto& elem : session->stack)
+			if (elem.type() == typeid(number_t))
+				values.push_back(std::any_cast<number_t>(elem));
+		return {};
+	}
+
+	uint64_t program::steps() const
+	{
+		return session->steps;
+	}
+
+	calculator::calculator()
+		:library(std::make_shared<wtf_calculator>())
+	{
+	}
+
+	calculator::calculator(calculator&&) noexcept = default;
+	calculator& calculator::operator=(calculator&&) noexcept = default;
+	calculator::~calculator() = default;
+
+	void calculator::load(std::string_view source)
+	{
+		std::istringstream iss{std::string(source)};
+
+		printed.clear();
+		library->capture = &printed;
+		auto done = library->file(iss, "<load>");
+		library->capture = nullptr;
+		library->verify_all();
+
+		unwrap(std::move(done));
+	}
+
+	program calculator::compile(std::string_view expression) const
+	{
+		return unwrap(try_compile(expression));
+	}
+
+	result<program> calculator::try_compile(std::string_view expression) const
+	{
+		program compiled(library);
+
+		auto code = compiled.session->compile(expression);
+		if (!code)
+			return std::unexpected(std::move(code.error()));
+		if (!compiled.session->compile_loops.empty())
+		{
+			compiled.session->compile_loops.clear();
+			return WC_ERROR(parse, "The program has an unterminated loop");
+		}
+		if (auto checked = compiled.session->verify(*code, wtf_calculator::frame_type::function); !checked)
+			return std::unexpected(std::move(checked.error()));
+
+		compiled.code = std::move(*code);
+		return compiled;
+	}
+}; // namespace wc
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <span>
+#include <any>
+#include <cstdint>
+
+#include "utility.hpp"
+#include "verify.hpp"
+
+namespace wc
+{
+	class wtf_calculator;
+
+	// An expression compiled against a calculator's functions and variables.
+	// A program keeps its own stacks and locals, so separate programs may run
+	// on separate threads; a single program may not. It shares the calculator's
+	// definitions, which it keeps alive, so it may outlive the calculator
+	class program
+	{
+	public:
+		using number_t = long double;
+
+	private:
+		std::shared_ptr<const wtf_calculator> library;
+		std::unique_ptr<wtf_calculator> session;
+		std::vector<std::any> code;
+		verdict_t verdict;
+		std::string printed;
+		uint64_t runs = 0;
+
+		friend class calculator;
+		explicit program(std::shared_ptr<const wtf_calculator> library);
+
+	public:
+		program(program&&) noexcept;
+		program& operator=(program&&) noexcept;
+		~program();
+
+		// Pushes inputs, runs the expression and returns the stack from the bottom.
+		// Run N draws random numbers from stream N of the seed, so a program
+		// gives the same results run after run. Errors are thrown as wc::exception
+		std::vector<number_t> run(std::span<const number_t> inputs = {});
+		void run(std::span<const number_t> inputs, std::vector<number_t>& values);
+
+		// Same as run, but errors are returned rather than thrown, which costs
+		// next to nothing when bad inputs are routine. The message of a
+		// wc::error is only formatted when asked for
+		result<> try_run(std::span<const number_t> inputs, std::vector<number_t>& values);
+
+		// Whatever the last run printed, e.g. through the print operation
+		const std::string& output() const { return printed; }
+
+		// Instructions the last run stepped through, including loop iterations
+		uint64_t steps() const;
+	};
+
+	// Holds the functions and global variables that programs are compiled against.
+	// Calculators are independent of one another, but for what the process has
+	// once: the buffer of standard output, the --sample timer and the interned
+	// names of the files code was read from
+	class calculator
+	{
+		std::shared_ptr<wtf_calculator> library;
+		std::string printed;
+
+	public:
+		calculator();
+		calculator(calculator&&) noexcept;
+		calculator& operator=(calculator&&) noexcept;
+		~calculator();
+
+		// Evaluates definitions such as defun and varg, as a script file would
+		void load(std::string_view source);
+
+		// Programs see the globals as they are at the time of compiling
+		program compile(std::string_view expression) const;
+		result<program> try_compile(std::string_view expression) const;
+	};
+}; // namespace wc
@@ -1,5 +1,27 @@
 #include "wc.hpp"
 
+#include <new>
+#include <cstdlib>
+
+// Counted for --profile; everything else about allocating stays as it was
+void* operator new(std::size_t size)
+{
+	wc::allocations++;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
 int main(int argc, char** argv)
 {
 	wc::wtf_calculator app;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+
+namespace wc
+{
+	// Results of a pure function by the numbers it takes, which match by value
+	// and sign. The table is bounded: a call landing on a taken slot replaces it
+	class memo_table
+	{
+		// Per slot: the arguments, then the results
+		std::vector<long double> slots;
+		std::vector<bool> used;
+		size_t arguments = 0, results = 0;
+
+		size_t width() const { return arguments + results; }
+
+		size_t slot(const long double* args) const
+		{
+			size_t hash = arguments;
+			for (size_t i = 0; i < arguments; i++)
+				hash = (hash * 1099511628211u) ^ std::hash<long double>()(args[i]);
+			return hash % used.size();
+		}
+
+		static bool same(long double a, long double b)
+		{
+			return a == b && std::signbit(a) == std::signbit(b);
+		}
+
+	public:
+		size_t capacity = 0;
+		uint64_t hits = 0, misses = 0;
+		// Of the definitions the shape and purity were taken at
+		uint64_t epoch = 0;
+		bool usable = false;
+
+		explicit memo_table(size_t capacity = 0) :capacity(capacity) {}
+
+		// Forgets every result, as the function or one it calls changed
+		void reset(size_t arguments, size_t results)
+		{
+			this->arguments = arguments;
+			this->results = results;
+			slots.assign(capacity * width(), 0);
+			used.assign(capacity, false);
+		}
+
+		size_t arity() const { return arguments; }
+		size_t result_count() const { return results; }
+
+		const long double* find(const long double* args) const
+		{
+			if (used.empty())
+				return nullptr;
+
+			const size_t at = slot(args);
+			const auto entry = &slots[at * width()];
+			if (!used[at] || !std::equal(args, args + arguments, entry, same))
+				return nullptr;
+			return entry + arguments;
+		}
+
+		void store(const long double* args, const long double* values)
+		{
+			if (used.empty())
+				return;
+
+			const size_t at = slot(args);
+			used[at] = true;
+			std::copy_n(args, arguments, &slots[at * width()]);
+			std::copy_n(values, results, &slots[at * width() + arguments]);
+		}
+	};
+}; // namespace wc
@@ -1,8 +1,105 @@
 #include "wc.hpp"
+#include "perfect_hash.hpp"
 
 namespace wc
 {
-	void wtf_calculator::op_add(wtf_calculator* ins)
+	namespace
+	{
+		constexpr auto num = operand_type::number;
+		constexpr auto str = operand_type::string;
+		constexpr auto opaque = effect_kind::opaque;
+	}
+
+	// Operands are listed bottom first, followed by the handler and the results.
+	// Operations whose effect on the stack is not fixed are opaque to the verifier
+	constexpr wtf_calculator::operation_t wtf_calculator::operations[] {
+		{"+", {num, num}, op_add, {num}},
+		{"-", {num, num}, op_subtract, {num}},
+		{"*", {num, num}, op_multiply, {num}},
+		{"/", {num, num}, op_divide, {num}},
+		{"^", {num, num}, op_power, {num}},
+
+		{"replace", {num, num}, op_replace, {num}},
+		{"swap", {num, num}, op_swap, {num, num}},
+		{"pop", {num}, op_pop},
+		{"top", {num}, op_top, {num}},
+		{"topb", {num}, op_topb, {num}},
+
+		{"<", {num, num}, op_less, {num}},
+		{">", {num, num}, op_greater, {num}},
+		{"<=", {num, num}, op_less_equal, {num}},
+		{">=", {num, num}, op_greater_equal, {num}},
+		{"=", {num, num}, op_equal, {num}},
+		{"!=", {num, num}, op_not_equal, {num}},
+
+		{"neg", {num}, op_neg, {num}}, {"abs", {num}, op_abs, {num}},
+		{"sin", {num}, op_sin, {num}}, {"cos", {num}, op_cos, {num}},
+		{"floor", {num}, op_floor, {num}}, {"ceil", {num}, op_ceil, {num}},
+
+		{"rand", {}, op_rand, {num}}, {"randn", {}, op_randn, {num}},
+		{"randv", {num}, op_randv, {}, opaque},
+		{"seed", {num}, op_seed},
+
+		{"help", {}, op_help}, {"stack", {}, op_stack}, {"quit", {}, op_quit},
+		{"clear", {}, op_clear, {}, effect_kind::clear}, {"file", {str}, op_file, {}, opaque},
+		{"_view", {}, op__view},
+
+		{"var", {num, str}, op_var},
+		{"set", {num, str}, op_set},
+		{"varg", {num, str}, op_varg},
+		{"vars", {}, op_vars},
+		{"del", {str}, op_del},
+		{"delall", {}, op_delall},
+		{"defvar", {str}, op_defvar, {}, opaque},
+
+		{"defun", {num, str}, op_defun, {}, opaque},
+		{"end", {}, op_end, {}, opaque},
+		{"desc", {str}, op_desc},
+		{"funcs", {}, op_funcs},
+		{"memo", {num, str}, op_memo},
+		{"_push_locals", {num, str}, op__push_locals},
+		{"_pop_locals", {str}, op__pop_locals},
+
+		{"desc-loop", {num}, op_desc_loop},
+		{"loops", {}, op_loops},
+		{"_use_times", {num, num}, op__use_times, {}, effect_kind::call_loop},
+		{"_use_ptimes", {num, str, num}, op__use_ptimes, {}, effect_kind::call_loop},
+		{"_use_while", {num}, op__use_while, {}, effect_kind::call_loop},
+		{"_use_until", {num}, op__use_until, {}, effect_kind::call_loop},
+		{"break-if", {num}, op_break_if, {}, effect_kind::break_if},
+
+		{"noverbose", {}, op_noverbose},
+		{"verbose", {}, op_verbose},
+
+		{"print", {str}, op_print},
+		{"println", {str}, op_println},
+
+		{"tic", {str}, op_tic},
+		{"toc", {str}, op_toc},
+
+		{"mem", {}, op_mem}
+	};
+
+	const wtf_calculator::operation_t* wtf_calculator::find_operation(std::string_view name)
+	{
+		constexpr size_t count = std::size(operations);
+		static constexpr perfect_hash<count> index([] {
+			std::array<std::string_view, count> names;
+			for (size_t i = 0; i < count; i++)
+				names[i] = operations[i].name;
+			return names;
+		}());
+
+		const auto candidate = index.candidate(name);
+		return candidate < count && operations[candidate].name == name ? &operations[candidate] : nullptr;
+	}
+
+	std::span<const wtf_calculator::operation_t> wtf_calculator::all_operations()
+	{
+		return operations;
+	}
+
+	result<> wtf_calculator::op_add(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
@@ -11,13 +108,14 @@ namespace wc
 
 		auto r = b + a;
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = {} + {}", ins->stack.size()+1, r, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "+", ins->stack.size()+1, {r, b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_subtract(wtf_calculator* ins)
+	result<> wtf_calculator::op_subtract(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
@@ -26,13 +124,14 @@ namespace wc
 
 		auto r = b - a;
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = {} - {}", ins->stack.size()+1, r, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "-", ins->stack.size()+1, {r, b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_multiply(wtf_calculator* ins)
+	result<> wtf_calculator::op_multiply(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
@@ -41,30 +140,32 @@ namespace wc
 
 		auto r = b * a;
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = {} * {}", ins->stack.size()+1, r, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "*", ins->stack.size()+1, {r, b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_divide(wtf_calculator* ins)
+	result<> wtf_calculator::op_divide(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 		if (std::fpclassify(a) == FP_ZERO)
-			WC_EXCEPTION(exec, "Cannot divide by 0");
+			return WC_ERROR(exec, "Cannot divide by 0");
 		auto b = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = b / a;
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = {} / {}", ins->stack.size()+1, r, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "/", ins->stack.size()+1, {r, b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_power(wtf_calculator* ins)
+	result<> wtf_calculator::op_power(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
@@ -73,113 +174,305 @@ namespace wc
 
 		auto r = std::pow(b, a);
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = {} ^ {}", ins->stack.size()+1, r, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "^", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_less(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b < a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "<", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_greater(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b > a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, ">", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_less_equal(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b <= a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "<=", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_greater_equal(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b >= a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, ">=", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_equal(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b == a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "=", ins->stack.size()+1, {r, b, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_not_equal(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+		auto b = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		number_t r = b != a;
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::binary, "!=", ins->stack.size()+1, {r, b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_stack(wtf_calculator* ins)
+	result<> wtf_calculator::op_stack(wtf_calculator* ins)
 	{
 		for (unsigned i = 0; i < ins->stack.size(); i++)
 		{
 			const auto& e = ins->stack[i];
 			if (e.type() == typeid(number_t))
 			{
-				std::print("{}: {}", i, std::any_cast<number_t>(e));
+				ins->print_out("{}: {}", i, std::any_cast<number_t>(e));
 			}
 			else
 				WC_STD_EXCEPTION("There shouldn't be non-number_t '{}' on the stack. "
 								 "This is a program error", e.type().name());
-			std::println("");
+			ins->println_out("");
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::op_quit(wtf_calculator* ins)
+	result<> wtf_calculator::op_quit(wtf_calculator* ins)
 	{
-		WC_EXCEPTION(repl_quit, "");
+		return WC_ERROR(repl_quit, "");
 	}
 
-	void wtf_calculator::op_replace(wtf_calculator* ins)
+	result<> wtf_calculator::op_replace(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 		auto b = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> replace {} > {}", ins->stack.size()+1, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::replace, "", ins->stack.size()+1, {b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(a));
+		return {};
 	}
 
-	void wtf_calculator::op_swap(wtf_calculator* ins)
+	result<> wtf_calculator::op_swap(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 		auto b = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> swap {} <> {}", ins->stack.size()+2, b, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::swap, "", ins->stack.size()+2, {b, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(a));
 		ins->stack.push_back(std::make_any<number_t>(b));
+		return {};
 	}
 
-	void wtf_calculator::op_pop(wtf_calculator* ins)
+	result<> wtf_calculator::op_pop(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> pop {}", ins->stack.size(), a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::pop, "", ins->stack.size(), {a}));
+		return {};
 	}
 
-	void wtf_calculator::op_clear(wtf_calculator* ins)
+	result<> wtf_calculator::op_clear(wtf_calculator* ins)
 	{
 		ins->stack.clear();
+		return {};
 	}
 
-	void wtf_calculator::op_file(wtf_calculator* ins)
+	result<> wtf_calculator::op_file(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
-		ins->file(name);
+		return ins->file(name);
 	}
 
-	void wtf_calculator::op__view(wtf_calculator* ins)
+	result<> wtf_calculator::op__view(wtf_calculator* ins)
 	{
 		ins->display_stack(ins->stack);
+		return {};
 	}
 
-	void wtf_calculator::op_top(wtf_calculator* ins)
+	result<> wtf_calculator::op_top(wtf_calculator* ins)
 	{
 		wtf_calculator::op_topb(ins);
-		std::println("");
+		if (!ins->raw_output)
+			ins->println_out("");
+		return {};
 	}
 
-	void wtf_calculator::op_topb(wtf_calculator* ins)
+	result<> wtf_calculator::op_topb(wtf_calculator* ins)
 	{
 		auto a = std::any_cast<number_t>(ins->stack.back());
 
-		std::print("{}", a);
+		ins->print_number(a);
+		return {};
 	}
 
-	void wtf_calculator::op_neg(wtf_calculator* ins)
+	result<> wtf_calculator::op_neg(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = -a;
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = -({})", ins->stack.size()+1, r, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "neg", ins->stack.size()+1, {r, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_abs(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		auto r = std::fabs(a);
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "abs", ins->stack.size()+1, {r, a}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_rand(wtf_calculator* ins)
+	{
+		auto r = ins->rng.uniform();
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::nullary, "rand", ins->stack.size()+1, {r}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_randn(wtf_calculator* ins)
+	{
+		auto r = ins->rng.normal();
+
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::nullary, "randn", ins->stack.size()+1, {r}));
+
+		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
+	}
+
+	result<> wtf_calculator::op_randv(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		if (!std::isfinite(a) || a < 0 || a != std::floor(a))
+			return WC_ERROR(eval, "Cannot generate {} random numbers, which is not a whole amount of at least 0", a);
+
+		// Each number costs an element and its box on the stack
+		constexpr size_t per_number = sizeof(element_t) + 2 * sizeof(number_t);
+		if (ins->max_memory && a > static_cast<number_t>(ins->max_memory / per_number))
+			return WC_ERROR(eval, "Cannot generate {} random numbers within the memory budget of {} bytes", a,
+							ins->max_memory);
+		if (a > static_cast<number_t>(ins->stack.max_size() - ins->stack.size()))
+			return WC_ERROR(eval, "Cannot generate {} random numbers at once", a);
+
+		std::vector<number_t> r(static_cast<size_t>(a));
+		ins->rng.fill_uniform(r.data(), r.size());
+
+		if (ins->tracing) [[unlikely]]
+		{
+			auto record = trace_values(trace_kind::randv, "", ins->stack.size()+r.size(), {});
+			record.count = r.size();
+			ins->trace(record);
+		}
+
+		for (auto x : r)
+			ins->stack.push_back(std::make_any<number_t>(x));
+		return {};
+	}
+
+	result<> wtf_calculator::op_seed(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		ins->rng_seed = static_cast<uint64_t>(std::llround(a));
+		ins->rng.reseed(ins->rng_seed, ins->rng_stream);
+
+		if (ins->tracing) [[unlikely]]
+		{
+			auto record = trace_values(trace_kind::seed, "", ins->stack.size(), {a});
+			record.count = ins->rng_stream;
+			ins->trace(record);
+		}
+		return {};
 	}
 
-	void wtf_calculator::op_help(wtf_calculator* ins)
+	result<> wtf_calculator::op_help(wtf_calculator* ins)
 	{
 		std::println(stderr, R"(operation: operand size: description:
 -------------------------------------
@@ -189,7 +482,11 @@ namespace wc
 /: n, n: division
 ^: n, n: power
 ---
+<, >, <=, >=: n, n: comparison, 1 if true and 0 otherwise
+=, !=: n, n: equality and inequality, same as above
+---
 neg: n: negate the top
+abs: n: absolute value
 sin: n: sine
 cos: n: cosine
 floor: n: floor
@@ -208,19 +505,28 @@ varg: n, s: set a global variable s with n
 vars: list all variables
 del: s: delete variable s
 delall: delete all variables
+defvar: s: begin a variable s whose value the expression up to end computes, again whenever a variable it reads changes
 ---
 defun: n, s: begin a function declaration
 end: end the function declaration
 desc: s: show the elements of the function
-funcs: briefly list out all functions
+funcs: briefly list out all functions, whether they are pure and how their memo fared
+memo: n, s: remember the results of up to n calls of the pure function s, 0 to forget them
 ---
 times: n: execute the loop code n times
 desc-loop: n: show the elements of loop n
-loops: briefly list out all loops
+loops: briefly list out all loops and the bodies freed or shared
 end-times: end the last times loop
+ptimes: n, s: execute the loop code n times across threads, then combine variables s like sum:sum,best:max. Only its own variables and those may be set, and break-if is refused
+end-ptimes: end the last ptimes loop
+while: loop while the number left at the end of the body is non-zero
+end-while: end the last while loop
+until: loop until the number left at the end of the body is non-zero
+end-until: end the last until loop
+break-if: n: leave the innermost loop if n is non-zero
 ---
-noverbose: suppress verbose even if enabled
-verbose: unsuppress verbose
+noverbose: suppress verbose and trace records even if enabled
+verbose: unsuppress verbose and trace records
 ---
 print: s: print s to standard output. '`' will be replaced with space
 println: s: print s and a newline to the standard output. Same with '`'
@@ -228,62 +534,71 @@ println: s: print s and a newline to the standard output. Same with '`'
 file: s: read commands from file
 quit: quit the REPL
 ---
+tic: s: start timing the region labelled s, summed up per label at exit
+toc: s: end the region labelled s and add its time to the label's
+mem: show the bytes held by the stacks, loops, functions and variables
+---
 help: show this screen)");
+		return {};
 	}
 
-	void wtf_calculator::op_sin(wtf_calculator* ins)
+	result<> wtf_calculator::op_sin(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = std::sin(a);
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = sin({})", ins->stack.size()+1, r, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "sin", ins->stack.size()+1, {r, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_cos(wtf_calculator* ins)
+	result<> wtf_calculator::op_cos(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = std::cos(a);
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = cos({})", ins->stack.size()+1, r, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "cos", ins->stack.size()+1, {r, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_floor(wtf_calculator* ins)
+	result<> wtf_calculator::op_floor(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = std::floor(a);
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = floor({})", ins->stack.size()+1, r, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "floor", ins->stack.size()+1, {r, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_ceil(wtf_calculator* ins)
+	result<> wtf_calculator::op_ceil(wtf_calculator* ins)
 	{
 		auto a = ins->resolve_variable_if(ins->stack.back());
 		ins->stack.pop_back();
 
 		auto r = std::ceil(a);
 
-		if (ins->verbose && !ins->suppress_verbose)
-			std::println(stderr, "{}> {} = ceil({})", ins->stack.size()+1, r, a);
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_values(trace_kind::unary, "ceil", ins->stack.size()+1, {r, a}));
 
 		ins->stack.push_back(std::make_any<number_t>(r));
+		return {};
 	}
 
-	void wtf_calculator::op_var(wtf_calculator* ins)
+	result<> wtf_calculator::op_var(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -316,20 +631,18 @@ help: show this screen)");
 
 		if (exists)
 		{
-			WC_EXCEPTION(exec, "Variable '{}' already exists at scope {}. You probably meant to use 'set'",
+			return WC_ERROR(exec, "Variable '{}' already exists at scope {}. You probably meant to use 'set'",
 						 name, is_local ? "local" : "global");
 		}
 
-		if (ins->verbose && !ins->suppress_verbose)
-		{
-			std::print(stderr, "{}> new ", ins->stack.size());
-			if (is_local)
-				std::print(stderr, "local:{} ", ins->variables_local.size()-1);
-			std::println(stderr, "${} = {}", name, value);
-		}
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_named(trace_kind::var, ins->stack.size(), name, value, ins->variables_local.size()-1,
+								   is_local));
+
+		return {};
 	}
 
-	void wtf_calculator::op_set(wtf_calculator* ins)
+	result<> wtf_calculator::op_set(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -357,29 +670,31 @@ help: show this screen)");
 
 		if (!found)
 		{
+			if (ins->derived.contains(name))
+				return WC_ERROR(exec, "Variable '{}' is derived from others. Use 'defvar' to change it", name);
+
 			auto it_global = ins->variables.find(name);
 			if (it_global != ins->variables.end())
 			{
 				found = true;
 				it_global->second = value;
+				ins->invalidate(name);
 			}
 		}
 
 		if (!found)
 		{
-			WC_EXCEPTION(exec, "No such variables '{}' exists in relevant scopes", name);
+			return WC_ERROR(exec, "No such variables '{}' exists in relevant scopes", name);
 		}
 
-		if (ins->verbose && !ins->suppress_verbose)
-		{
-			std::print(stderr, "{}> ", ins->stack.size());
-			if (is_local)
-				std::print(stderr, "local:{} ", ins->variables_local.size()-1);
-			std::println(stderr, "${} = {}", name, value);
-		}
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_named(trace_kind::set, ins->stack.size(), name, value, ins->variables_local.size()-1,
+								   is_local));
+
+		return {};
 	}
 
-	void wtf_calculator::op_varg(wtf_calculator* ins)
+	result<> wtf_calculator::op_varg(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -393,21 +708,23 @@ help: show this screen)");
 		}
 		else
 		{
-			WC_EXCEPTION(exec, "Variable '{}' already exists at scope global."
+			return WC_ERROR(exec, "Variable '{}' already exists at scope global."
 						 "You probably meant to use operation 'set'", name);
 		}
 
-		if (ins->verbose && !ins->suppress_verbose)
-		{
-			std::println(stderr, "{}> new ${} = {}", ins->stack.size(), name, value);
-		}
+		if (ins->tracing) [[unlikely]]
+			ins->trace(trace_named(trace_kind::varg, ins->stack.size(), name, value));
+
+		return {};
 	}
 
-	void wtf_calculator::op_vars(wtf_calculator* ins)
+	result<> wtf_calculator::op_vars(wtf_calculator* ins)
 	{
 		for (const auto& [name, value] : ins->variables)
 		{
-			std::println("${}: {}", name, value);
+			const auto it = ins->derived.find(name);
+			ins->println_out("${}: {}{}", name, value,
+							 it == ins->derived.end() ? "" : it->second.stale ? ", derived, stale" : ", derived");
 		}
 
 		unsigned i = 0;
@@ -415,13 +732,15 @@ help: show this screen)");
 		{
 			for (const auto& [name, value] : locals)
 			{
-				std::println("local:{},{} ${}: {}", static_cast<int>(scope), i, name, value);
+				ins->println_out("local:{},{} ${}: {}", static_cast<int>(scope), i, name, value);
 			}
 			i++;
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::op_del(wtf_calculator* ins)
+	result<> wtf_calculator::op_del(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -429,25 +748,31 @@ help: show this screen)");
 		const auto it = ins->variables.find(name);
 		if (it == ins->variables.end())
 		{
-			WC_EXCEPTION(exec, "No such variable '{}' exists", name);
+			return WC_ERROR(exec, "No such variable '{}' exists", name);
 		}
 		else
 		{
 			ins->variables.erase(it);
+			ins->forget_derived(name);
+			ins->invalidate(name);
 
-			if (ins->verbose && !ins->suppress_verbose)
-			{
-				std::println(stderr, "{}> del ${}", ins->stack.size(), name);
-			}
+			if (ins->tracing) [[unlikely]]
+				ins->trace(trace_named(trace_kind::del, ins->stack.size(), name));
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::op_delall(wtf_calculator* ins)
+	result<> wtf_calculator::op_delall(wtf_calculator* ins)
 	{
 		ins->variables.clear();
+		ins->derived.clear();
+		ins->dependents.clear();
+		ins->stale_derived = 0;
+		return {};
 	}
 
-	void wtf_calculator::op_defun(wtf_calculator* ins)
+	result<> wtf_calculator::op_defun(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -456,162 +781,285 @@ help: show this screen)");
 
 		if (!ins->current_eval_function.empty())
 		{
-			WC_EXCEPTION(exec, "Cannot begin parsing '{}' as another function is currently being", name);
+			return WC_ERROR(exec, "Cannot begin parsing '{}' as another function is currently being", name);
+		}
+		if (ins->is_running(name))
+		{
+			return WC_ERROR(exec, "Cannot redefine '{}' while it runs", name);
 		}
 
-		ins->functions[name] = function_t(num, {});
+		ins->functions[name] = function_t(num, {}, {}, {});
 		ins->current_eval_function = name;
+		ins->definitions++;
+		return {};
+	}
+
+	// Collected like a function, under a name no function can be called by
+	result<> wtf_calculator::op_defvar(wtf_calculator* ins)
+	{
+		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
+		ins->stack.pop_back();
+
+		if (!ins->current_eval_function.empty())
+		{
+			return WC_ERROR(exec, "Cannot begin parsing '{}' as a function is currently being", name);
+		}
+		if (ins->is_running("$" + name))
+		{
+			return WC_ERROR(exec, "Cannot redefine '{}' while it runs", name);
+		}
+
+		ins->functions["$" + name] = function_t(0, {}, {}, {});
+		ins->current_eval_function = "$" + name;
+		ins->definitions++;
+		return {};
 	}
 
-	void wtf_calculator::op_end(wtf_calculator* ins)
+	result<> wtf_calculator::op_end(wtf_calculator* ins)
 	{
 		if (ins->current_eval_function.empty())
 		{
-			WC_EXCEPTION(exec, "Unexpected call to operation end");
+			return WC_ERROR(exec, "Unexpected call to operation end");
 		}
 
+		const auto name = std::move(ins->current_eval_function);
 		ins->current_eval_function.clear();
+		ins->definitions++;
+
+		if (name.starts_with('$'))
+		{
+			auto definition = ins->functions.extract(name);
+			return ins->define_variable(name.substr(1), std::move(definition.mapped()));
+		}
+
+		// Derived variables may call it, and are computed again when read
+		for (auto& [var_name, var] : ins->derived)
+		{
+			if (!var.stale)
+			{
+				var.stale = true;
+				ins->stale_derived++;
+			}
+		}
+
+		// A function that cannot run is rejected as it is defined
+		auto& [opr_count, func_stack, verdict, func_lines] = ins->functions[name];
+		auto checked = ins->verify(func_stack, frame_type::function);
+		if (!checked)
+		{
+			ins->functions.erase(name);
+			return std::unexpected(std::move(checked.error()));
+		}
+		verdict = std::move(*checked);
+
+		return {};
 	}
 
-	void wtf_calculator::op_desc(wtf_calculator* ins)
+	result<> wtf_calculator::op_desc(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
 
-		const auto it = ins->functions.find(name);
-		if (it == ins->functions.end())
+		const auto func = ins->find_function(name);
+		if (!func)
 		{
-			WC_EXCEPTION(exec, "No such function '{}' exists", name);
+			return WC_ERROR(exec, "No such function '{}' exists", name);
 		}
 		else
 		{
-			const auto& func_stack = std::get<1>(it->second);
-			wtf_calculator::display_stack(func_stack);
+			const auto& func_stack = std::get<1>(*func);
+			ins->display_stack(func_stack);
 		}
+
+		return {};
 	}
 
-    void wtf_calculator::op_funcs(wtf_calculator* ins)
+	result<> wtf_calculator::op_funcs(wtf_calculator* ins)
 	{
-		for (const auto& [name, stuff] : ins->functions)
+		for (auto& [name, stuff] : ins->functions)
 		{
-			std::println("@{}: {} arguments, {} elements",
-						 name, std::get<0>(stuff), std::get<1>(stuff).size());
+			auto& [opr_count, func_stack, verdict, func_lines] = stuff;
+			ins->refresh(verdict, func_stack, frame_type::function);
+
+			std::vector<std::string> visiting;
+			const bool pure = ins->check_pure(name, visiting).has_value();
+			ins->print_out("@{}: {} arguments, {} elements{}{}", name, opr_count, func_stack.size(),
+						   verdict.verified ? ", verified" : "", pure ? ", pure" : "");
+
+			if (const auto memo = ins->memos.find(name); memo != ins->memos.end())
+				ins->print_out(", memo of {}: {} hits, {} misses", memo->second.capacity, memo->second.hits,
+							   memo->second.misses);
+			ins->print_out("\n");
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::op__push_locals(wtf_calculator* ins)
+	result<> wtf_calculator::op_memo(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
-		auto scope = ins->resolve_variable_if(ins->stack.back());
+		const auto capacity = std::any_cast<number_t>(ins->stack.back());
 		ins->stack.pop_back();
 
-		if (ins->verbose && !ins->suppress_verbose)
+		const verdict_t* verdict;
+		if (!ins->find_function(name, verdict))
+			return WC_ERROR(exec, "No such function '{}' exists", name);
+
+		if (capacity < 1)
 		{
-			std::println(stderr, "{}> begin {} - {},{}",
-						 ins->stack.size(), name, scope, ins->variables_local.size());
+			ins->memos.erase(name);
+			return {};
 		}
 
-		ins->variables_local.push_back({static_cast<scope_type>(scope), {}});
+		if (auto usable = ins->check_memo(name, verdict); !usable)
+			return usable;
+
+		// Checked again on the next call once anything is redefined
+		ins->memos.insert_or_assign(name, memo_table(static_cast<size_t>(capacity)));
+		return {};
 	}
 
-	void wtf_calculator::op__pop_locals(wtf_calculator* ins)
+	result<> wtf_calculator::op__push_locals(wtf_calculator* ins)
 	{
 		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
+		auto scope = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
 
-		if (ins->variables_local.empty())
-		{
-			WC_STD_EXCEPTION("Operation '_pop_locals' executed on an empty list. This is a program error");
-		}
-
-		if (ins->verbose && !ins->suppress_verbose)
-		{
-			auto scope = static_cast<int>(std::get<0>(ins->variables_local.back()));
-			auto freed = std::get<1>(ins->variables_local.back()).size();
-			std::print(stderr, "{}> end {} - {},{}",
-					   ins->stack.size(), name, scope, ins->variables_local.size()-1);
-			if (freed > 0)
-				std::print(stderr, " - freed {} variables", freed);
-			std::println(stderr, "");
-		}
-
-		ins->variables_local.pop_back();
+		ins->push_locals(static_cast<scope_type>(scope), name);
+		return {};
 	}
 
-	void wtf_calculator::op_times(wtf_calculator* ins)
+	result<> wtf_calculator::op__pop_locals(wtf_calculator* ins)
 	{
-	    ins->current_eval_times.push_back(ins->times.size());
-		ins->times.push_back({});
+		auto name = std::any_cast<std::string&&>(std::move(ins->stack.back()));
+		ins->stack.pop_back();
+
+		ins->pop_locals(name);
+		return {};
 	}
 
-	void wtf_calculator::op_loops(wtf_calculator* ins)
+	result<> wtf_calculator::op_loops(wtf_calculator* ins)
 	{
+		const unsigned library_loops = ins->library ? ins->library->loop_count() : 0;
+
 		unsigned i=0;
-		for (const auto& s : ins->times)
+		for (const auto& loop : ins->times)
 		{
-			std::println("times:{}: {} elements", i, s.size());
+			if (loop)
+			{
+				const auto verdict = ins->loop_verdict(library_loops + i);
+				ins->println_out("times:{}: {} elements{}", i, loop->body.size(),
+								 verdict->verified ? ", verified" : "");
+			}
 			i++;
 		}
+
+		if (ins->loops_reclaimed || ins->loops_shared)
+			ins->println_out("reclaimed {} bodies ({} bytes), shared {}", ins->loops_reclaimed,
+							 ins->loop_bytes_reclaimed, ins->loops_shared);
+		return {};
 	}
 
-	void wtf_calculator::op_desc_loop(wtf_calculator* ins)
+	result<> wtf_calculator::op_desc_loop(wtf_calculator* ins)
 	{
 		auto index = (unsigned)std::any_cast<number_t>(ins->stack.back());
 		ins->stack.pop_back();
 
-		if (index >= ins->times.size())
+		if (!ins->has_loop(index))
 		{
-			WC_EXCEPTION(exec, "No times at index {} exists", index);
+			return WC_ERROR(exec, "No times at index {} exists", index);
 		}
 
-		const auto& times_stack = ins->times[index];
-		wtf_calculator::display_stack(times_stack);
+		const auto& times_stack = ins->loop_body(index);
+		ins->display_stack(times_stack);
+		return {};
 	}
 
-	void wtf_calculator::op_end_times(wtf_calculator* ins)
+	result<> wtf_calculator::op__use_times(wtf_calculator* ins)
 	{
-		if (ins->current_eval_times.empty())
+		auto index = (unsigned)std::any_cast<number_t>(ins->stack.back());
+		ins->stack.pop_back();
+		auto loops = (unsigned)std::any_cast<number_t>(ins->stack.back());
+		ins->stack.pop_back();
+
+		if (loops > 0)
 		{
-			WC_STD_EXCEPTION("Unexpected operation 'end-times'");
+			ins->push_frame(frame_type::times, ins->loop_body(index), &ins->loop_lines(index), loops,
+							"times:" + std::to_string(index), !ins->entry_holds(ins->loop_verdict(index)));
 		}
-		ins->current_eval_times.pop_back();
+		return {};
 	}
 
-	void wtf_calculator::op__use_times(wtf_calculator* ins)
+	result<> wtf_calculator::op__use_ptimes(wtf_calculator* ins)
 	{
 		auto index = (unsigned)std::any_cast<number_t>(ins->stack.back());
 		ins->stack.pop_back();
+		auto reductions = std::any_cast<std::string&&>(std::move(ins->stack.back()));
+		ins->stack.pop_back();
 		auto loops = (unsigned)std::any_cast<number_t>(ins->stack.back());
 		ins->stack.pop_back();
 
-		std::string name = "times:";
-		name += std::to_string(index);
-		for (unsigned i=0; i < loops; i++)
+		return ins->parallel_times(index, loops, reductions);
+	}
+
+	result<> wtf_calculator::op__use_while(wtf_calculator* ins)
+	{
+		auto index = (unsigned)std::any_cast<number_t>(ins->stack.back());
+		ins->stack.pop_back();
+
+		ins->push_frame(frame_type::while_loop, ins->loop_body(index), &ins->loop_lines(index), 0,
+						"while:" + std::to_string(index), !ins->entry_holds(ins->loop_verdict(index)));
+		return {};
+	}
+
+	result<> wtf_calculator::op__use_until(wtf_calculator* ins)
+	{
+		auto index = (unsigned)std::any_cast<number_t>(ins->stack.back());
+		ins->stack.pop_back();
+
+		ins->push_frame(frame_type::until_loop, ins->loop_body(index), &ins->loop_lines(index), 0,
+						"until:" + std::to_string(index), !ins->entry_holds(ins->loop_verdict(index)));
+		return {};
+	}
+
+	result<> wtf_calculator::op_break_if(wtf_calculator* ins)
+	{
+		auto a = ins->resolve_variable_if(ins->stack.back());
+		ins->stack.pop_back();
+
+		if (ins->frames.empty() || ins->frames.back().type == frame_type::function)
 		{
-			ins->secondary_stack.push_front(ins->operations.find("_pop_locals"));
-			ins->secondary_stack.push_front(name);
-			for (auto it = ins->times[index].rbegin(); it != ins->times[index].rend(); it++)
-			{
-				ins->secondary_stack.push_front(*it);
-			}
-			ins->secondary_stack.push_front(ins->operations.find("_push_locals"));
-			ins->secondary_stack.push_front(name);
-			ins->secondary_stack.push_front(static_cast<number_t>(wtf_calculator::scope_type::loop));
+			return WC_ERROR(exec, "Operation 'break-if' used outside of a loop");
+		}
+
+		if (std::fpclassify(a) != FP_ZERO)
+		{
+			if (ins->tracing) [[unlikely]]
+				ins->trace(trace_named(trace_kind::break_loop, ins->stack.size(), ins->frames.back().name));
+
+			ins->pop_frame();
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::op_noverbose(wtf_calculator* ins)
+	result<> wtf_calculator::op_noverbose(wtf_calculator* ins)
 	{
 		ins->suppress_verbose = true;
+		ins->update_tracing();
+		return {};
 	}
 
-	void wtf_calculator::op_verbose(wtf_calculator* ins)
+	result<> wtf_calculator::op_verbose(wtf_calculator* ins)
 	{
 		ins->suppress_verbose = false;
+		ins->update_tracing();
+		return {};
 	}
 
-	void wtf_calculator::op_print(wtf_calculator* ins)
+	result<> wtf_calculator::op_print(wtf_calculator* ins)
 	{
 		auto what = std::any_cast<std::string&&>(std::move(ins->stack.back()));
 		ins->stack.pop_back();
@@ -620,12 +1068,47 @@ help: show this screen)");
 			if (what[i] == '`')
 				what[i] = ' ';
 
-		std::print("{}", what);
+		ins->print_out("{}", what);
+		return {};
 	}
 
-	void wtf_calculator::op_println(wtf_calculator* ins)
+	result<> wtf_calculator::op_println(wtf_calculator* ins)
 	{
 		op_print(ins);
-		std::println("");
+		ins->println_out("");
+		return {};
+	}
+
+	result<> wtf_calculator::op_tic(wtf_calculator* ins)
+	{
+		auto label = std::any_cast<std::string&&>(std::move(ins->stack.back()));
+		ins->stack.pop_back();
+
+		if (ins->timer)
+			ins->timer->tic(label);
+		return {};
+	}
+
+	result<> wtf_calculator::op_toc(wtf_calculator* ins)
+	{
+		auto label = std::any_cast<std::string&&>(std::move(ins->stack.back()));
+		ins->stack.pop_back();
+
+		return ins->timer ? ins->timer->toc(label) : result<> {};
+	}
+
+	result<> wtf_calculator::op_mem(wtf_calculator* ins)
+	{
+		const auto held = ins->memory();
+		ins->memory_peak = std::max(ins->memory_peak, held.total());
+
+		ins->println_out("stacks: {}", held.stacks);
+		ins->println_out("loops: {}", held.loops);
+		ins->println_out("functions: {}", held.functions);
+		ins->println_out("variables: {}", held.variables);
+		ins->println_out("locals: {}", held.locals);
+		ins->println_out("total: {}, peak: {}{}", held.total(), ins->memory_peak,
+						 ins->max_memory ? std::format(", budget: {}", ins->max_memory) : "");
+		return {};
 	}
 }; // namespace wc
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstdio>
+#include <format>
+#include <iterator>
+
+#include <unistd.h>
+
+namespace wc
+{
+	// Standard output gathered into large blocks, as a batch job may print
+	// millions of short lines. A terminal gets everything as it is written
+	class output_sink
+	{
+		std::FILE* file;
+		std::string buffer;
+		bool interactive;
+
+	public:
+		static constexpr size_t block = 1 << 16;
+
+		explicit output_sink(std::FILE* file)
+			:file(file), interactive(isatty(fileno(file)))
+		{
+			buffer.reserve(block + block / 4);
+		}
+		output_sink(const output_sink&) = delete;
+		~output_sink() { flush(); }
+
+		// To append to directly, calling written() after
+		std::string& pending() { return buffer; }
+		void written()
+		{
+			if (interactive || buffer.size() >= block)
+				flush();
+		}
+
+		template<typename... Args>
+		void print(std::format_string<Args...> fmt, Args&&... args)
+		{
+			std::format_to(std::back_inserter(buffer), fmt, std::forward<Args>(args)...);
+			written();
+		}
+
+		// Before anything else writes to the file
+		void flush()
+		{
+			if (!buffer.empty())
+				std::fwrite(buffer.data(), 1, buffer.size(), file);
+			buffer.clear();
+			std::fflush(file);
+		}
+	};
+
+	// Written by the main thread only; workers and sessions capture their output
+	inline output_sink& standard_output()
+	{
+		static output_sink sink(stdout);
+		return sink;
+	}
+
+	// The shortest text that reads back as the same number, which is what
+	// std::format gives for "{}" without parsing a format string
+	inline void append_number(std::string& to, long double value)
+	{
+		char text[64];
+		const auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+		to.append(text, end);
+	}
+
+	// For --raw-output, a native-endian IEEE double of 8 bytes
+	inline void append_raw(std::string& to, long double value)
+	{
+		const double narrowed = static_cast<double>(value);
+		to.append(reinterpret_cast<const char*>(&narrowed), sizeof(narrowed));
+	}
+}; // namespace wc
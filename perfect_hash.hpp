@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+
+namespace wc
+{
+	// Collision-free index over a fixed set of names, built at compile time.
+	// A lookup hashes the name once and compares it against the single
+	// candidate its slot holds
+	template<size_t N>
+	class perfect_hash
+	{
+		static constexpr size_t slot_count = std::bit_ceil(N * 4);
+		static constexpr uint16_t empty = 0xffff;
+		static_assert(N < empty, "perfect_hash indexes at most 65534 names");
+
+		uint32_t seed = 0;
+		std::array<uint16_t, slot_count> slots {};
+
+		static constexpr size_t slot_of(std::string_view name, uint32_t seed)
+		{
+			// FNV-1a, with the seed folded into the offset basis
+			uint32_t h = 2166136261u ^ seed;
+			for (const char c : name)
+			{
+				h ^= static_cast<unsigned char>(c);
+				h *= 16777619u;
+			}
+			h ^= h >> 15;
+			return h & (slot_count - 1);
+		}
+
+	public:
+		consteval perfect_hash(const std::array<std::string_view, N>& names)
+		{
+			for (;; seed++)
+			{
+				slots.fill(empty);
+
+				bool collides = false;
+				for (size_t i = 0; i < N && !collides; i++)
+				{
+					auto& slot = slots[slot_of(names[i], seed)];
+					collides = slot != empty;
+					slot = static_cast<uint16_t>(i);
+				}
+				if (!collides)
+					break;
+			}
+		}
+
+		// Index of the only name that could equal this one, or N if there is none
+		constexpr size_t candidate(std::string_view name) const
+		{
+			const auto index = slots[slot_of(name, seed)];
+			return index == empty ? N : index;
+		}
+	};
+}; // namespace wc
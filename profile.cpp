@@ -0,0 +1,187 @@
+#include "profile.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <print>
+
+#include <sys/time.h>
+
+namespace wc
+{
+	constinit thread_local uint64_t allocations = 0;
+	std::atomic<bool> sample_pending = false;
+	std::atomic<sampler*> sampler::active = nullptr;
+
+	namespace
+	{
+		constexpr std::array<std::string_view, 3> profile_kind_str {"operation", "function", "loop"};
+
+		void on_profile_signal(int)
+		{
+			sample_pending.store(true, std::memory_order_relaxed);
+		}
+
+		template<typename Map>
+		void collect(std::vector<const profiler::record_t*>& to, const Map& from)
+		{
+			for (const auto& [key, record] : from)
+				to.push_back(&record);
+		}
+	}
+
+	profiler::record_t& profiler::operation(const void* key, std::string_view name)
+	{
+		auto [it, added] = operations.try_emplace(key);
+		if (added)
+		{
+			it->second.name = name;
+			it->second.kind = profile_kind::operation;
+		}
+		return it->second;
+	}
+
+	profiler::record_t& profiler::block(std::string_view name, profile_kind kind)
+	{
+		auto [it, added] = blocks.try_emplace(std::string(name));
+		if (added)
+		{
+			it->second.name = name;
+			it->second.kind = kind;
+		}
+		return it->second;
+	}
+
+	void profiler::leave(uint64_t id)
+	{
+		auto it = std::find_if(open.rbegin(), open.rend(), [id](const open_t& o) { return o.id == id; });
+		if (it == open.rend())
+			return;
+
+		const auto inclusive = now_ns() - it->start_ns;
+		const auto allocated = allocations - it->start_allocations;
+
+		auto& record = *it->record;
+		record.calls++;
+		record.inclusive_ns += inclusive;
+		record.exclusive_ns += inclusive - std::min(inclusive, it->child_ns);
+		record.allocations += allocated - std::min(allocated, it->child_allocations);
+
+		// Whatever is below takes this entry as its child
+		const auto at = open.end() - (it - open.rbegin()) - 1;
+		if (at != open.begin())
+		{
+			auto& parent = *(at - 1);
+			parent.child_ns += inclusive;
+			parent.child_allocations += allocated;
+		}
+		open.erase(at);
+	}
+
+	void profiler::merge(profiler& other)
+	{
+		auto add = [](record_t& to, const record_t& from) {
+			to.calls += from.calls;
+			to.inclusive_ns += from.inclusive_ns;
+			to.exclusive_ns += from.exclusive_ns;
+			to.allocations += from.allocations;
+		};
+
+		for (const auto& [key, record] : other.operations)
+			add(operation(key, record.name), record);
+		for (const auto& [name, record] : other.blocks)
+			add(block(name, record.kind), record);
+
+		other.operations.clear();
+		other.blocks.clear();
+	}
+
+	void profiler::report(std::FILE* out, std::chrono::nanoseconds wall) const
+	{
+		std::vector<const record_t*> sorted;
+		collect(sorted, operations);
+		collect(sorted, blocks);
+		std::sort(sorted.begin(), sorted.end(), [](const record_t* a, const record_t* b) {
+			return a->exclusive_ns != b->exclusive_ns ? a->exclusive_ns > b->exclusive_ns : a->name < b->name;
+		});
+
+		uint64_t total = 0;
+		for (const auto record : sorted)
+			total += record->exclusive_ns;
+
+		std::println(out, "Profile over {:.3f} ms, sorted by exclusive time (times of workers add up)",
+					 wall.count() / 1e6);
+		std::println(out, "{:<20} {:<9} {:>10} {:>12} {:>12} {:>7} {:>10}",
+					 "name", "kind", "calls", "incl ms", "excl ms", "excl %", "allocs");
+		for (const auto record : sorted)
+		{
+			std::println(out, "{:<20} {:<9} {:>10} {:>12.3f} {:>12.3f} {:>7.2f} {:>10}",
+						 record->name, profile_kind_str[static_cast<int>(record->kind)], record->calls,
+						 record->inclusive_ns / 1e6, record->exclusive_ns / 1e6,
+						 total ? 100.0 * record->exclusive_ns / total : 0.0, record->allocations);
+		}
+	}
+
+	void profiler::write_json(std::ostream& os, std::chrono::nanoseconds wall) const
+	{
+		std::vector<const record_t*> all;
+		collect(all, operations);
+		collect(all, blocks);
+		std::sort(all.begin(), all.end(), [](const record_t* a, const record_t* b) { return a->name < b->name; });
+
+		os << std::format("{{\n  \"wall_ns\": {},\n  \"entries\": [", wall.count());
+		for (size_t i = 0; i < all.size(); i++)
+		{
+			const auto& r = *all[i];
+			os << std::format("{}\n    {{\"name\": {}, \"kind\": \"{}\", \"calls\": {}, \"inclusive_ns\": {}, "
+							  "\"exclusive_ns\": {}, \"allocations\": {}}}",
+							  i ? "," : "", json_string(r.name), profile_kind_str[static_cast<int>(r.kind)],
+							  r.calls, r.inclusive_ns, r.exclusive_ns, r.allocations);
+		}
+		os << "\n  ]\n}\n";
+	}
+
+	void sampler::start(unsigned hz)
+	{
+		if (running)
+			return;
+
+		struct sigaction sa {};
+		sa.sa_handler = on_profile_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGPROF, &sa, &old_action);
+
+		active = this;
+		running = true;
+
+		const long usec = 1000000 / std::max(hz, 1u);
+		itimerval timer {{usec / 1000000, usec % 1000000}, {usec / 1000000, usec % 1000000}};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+	}
+
+	void sampler::stop()
+	{
+		if (!running)
+			return;
+
+		itimerval timer {};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		sigaction(SIGPROF, &old_action, nullptr);
+
+		active = nullptr;
+		sample_pending = false;
+		running = false;
+	}
+
+	void sampler::write_folded(std::ostream& os)
+	{
+		std::lock_guard lock(mutex);
+
+		std::vector<std::pair<std::string_view, uint64_t>> sorted(stacks.begin(), stacks.end());
+		std::sort(sorted.begin(), sorted.end());
+		for (const auto& [stack, count] : sorted)
+			os << stack << ' ' << count << '\n';
+	}
+}; // namespace wc
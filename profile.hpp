@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <ostream>
+#include <atomic>
+#include <mutex>
+#include <csignal>
+
+namespace wc
+{
+	// Allocations made by the current thread so far. The wc executable counts
+	// them in its operator new; code linking only libwc sees none
+	extern constinit thread_local uint64_t allocations;
+
+	enum class profile_kind { operation, function, loop };
+
+	// Call counts and time spent per operation, function and loop for --profile.
+	// Exclusive figures leave out what was spent in the entries entered meanwhile
+	class profiler
+	{
+	public:
+		struct record_t {
+			std::string name;
+			profile_kind kind;
+			uint64_t calls = 0, inclusive_ns = 0, exclusive_ns = 0, allocations = 0;
+		};
+
+	private:
+		struct open_t {
+			record_t* record;
+			uint64_t id, start_ns, child_ns, start_allocations, child_allocations;
+		};
+
+		std::unordered_map<const void*, record_t> operations;
+		std::unordered_map<std::string, record_t> blocks;
+		std::vector<open_t> open;
+		uint64_t next_id = 0;
+
+		static uint64_t now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+	public:
+		// Operations are keyed by their registry entry, functions and loops by name
+		record_t& operation(const void* key, std::string_view name);
+		record_t& block(std::string_view name, profile_kind kind);
+
+		uint64_t enter(record_t& record)
+		{
+			open.push_back({&record, ++next_id, now_ns(), 0, allocations, 0});
+			return next_id;
+		}
+
+		// Entries need not be left in the order they were entered: an operation
+		// may start a loop that outlives it, or break out of the loop it is in
+		void leave(uint64_t id);
+
+		// Moves the records of a worker or a session into this one
+		void merge(profiler& other);
+
+		void report(std::FILE* out, std::chrono::nanoseconds wall) const;
+		void write_json(std::ostream& os, std::chrono::nanoseconds wall) const;
+	};
+
+	// Set on SIGPROF while a sampler runs. The evaluator takes the sample before
+	// its next instruction, where the frames it walks are consistent
+	extern std::atomic<bool> sample_pending;
+
+	// Interpreter stacks sampled on the process's CPU time, counted as folded
+	// stacks, the input of flamegraph tools
+	class sampler
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, uint64_t> stacks;
+		struct sigaction old_action {};
+		bool running = false;
+
+	public:
+		// Only one sampler runs at a time, as the timer is the process's
+		static std::atomic<sampler*> active;
+
+		~sampler() { stop(); }
+
+		void start(unsigned hz);
+		void stop();
+
+		void add(std::string stack)
+		{
+			std::lock_guard lock(mutex);
+			stacks[std::move(stack)]++;
+		}
+
+		void write_folded(std::ostream& os);
+	};
+}; // namespace wc
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+namespace wc
+{
+	// Philox4x32-10 counter-based generator. Every output block is a pure
+	// function of (key, counter), so blocks can be generated independently
+	// and streams never overlap: the seed forms the key and the stream id
+	// occupies the upper half of the counter
+	class philox4x32
+	{
+	public:
+		using block_t = std::array<uint32_t, 4>;
+
+	private:
+		static constexpr uint32_t mul_0 = 0xD2511F53, mul_1 = 0xCD9E8D57;
+		static constexpr uint32_t weyl_0 = 0x9E3779B9, weyl_1 = 0xBB67AE85;
+		static constexpr unsigned rounds = 10;
+		static constexpr long double two_pow_m64 = 0x1p-64L;
+
+		uint32_t key_0 = 0, key_1 = 0;
+		uint32_t stream_0 = 0, stream_1 = 0;
+		uint64_t index = 0;
+
+		bool has_spare = false;
+		long double spare = 0;
+
+	public:
+		philox4x32(uint64_t seed = 0, uint64_t stream = 0)
+		{
+			reseed(seed, stream);
+		}
+
+		void reseed(uint64_t seed, uint64_t stream)
+		{
+			key_0 = static_cast<uint32_t>(seed);
+			key_1 = static_cast<uint32_t>(seed >> 32);
+			stream_0 = static_cast<uint32_t>(stream);
+			stream_1 = static_cast<uint32_t>(stream >> 32);
+			index = 0;
+			has_spare = false;
+		}
+
+		static block_t block(uint64_t index, uint32_t stream_0, uint32_t stream_1,
+							 uint32_t key_0, uint32_t key_1)
+		{
+			uint32_t c0 = static_cast<uint32_t>(index), c1 = static_cast<uint32_t>(index >> 32);
+			uint32_t c2 = stream_0, c3 = stream_1;
+
+			for (unsigned r = 0; r < rounds; r++)
+			{
+				const uint64_t p0 = uint64_t(mul_0) * c0, p1 = uint64_t(mul_1) * c2;
+				const uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ key_0, n1 = uint32_t(p1);
+				const uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ key_1, n3 = uint32_t(p0);
+				c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+				key_0 += weyl_0; key_1 += weyl_1;
+			}
+
+			return {c0, c1, c2, c3};
+		}
+
+		// Fills out[0..count) with uniforms in [0, 1). The blocks carry no
+		// dependency on each other, which lets the compiler vectorize the loop
+		void fill_uniform(long double* out, size_t count)
+		{
+			const size_t blocks = count / 2;
+			for (size_t i = 0; i < blocks; i++)
+			{
+				const auto b = block(index + i, stream_0, stream_1, key_0, key_1);
+				out[2*i] = to_unit((uint64_t(b[1]) << 32) | b[0]);
+				out[2*i + 1] = to_unit((uint64_t(b[3]) << 32) | b[2]);
+			}
+			index += blocks;
+
+			if (count % 2 != 0)
+			{
+				const auto b = block(index++, stream_0, stream_1, key_0, key_1);
+				out[count - 1] = to_unit((uint64_t(b[1]) << 32) | b[0]);
+			}
+		}
+
+		long double uniform()
+		{
+			long double r;
+			fill_uniform(&r, 1);
+			return r;
+		}
+
+		// Box-Muller; the second value of each pair is kept for the next call
+		long double normal()
+		{
+			if (has_spare)
+			{
+				has_spare = false;
+				return spare;
+			}
+
+			std::array<long double, 2> u;
+			fill_uniform(u.data(), u.size());
+
+			const long double radius = std::sqrt(-2 * std::log1p(-u[0]));
+			const long double theta = 2 * 3.141592653589793238L * u[1];
+			spare = radius * std::sin(theta);
+			has_spare = true;
+			return radius * std::cos(theta);
+		}
+
+	private:
+		static long double to_unit(uint64_t x)
+		{
+			return static_cast<long double>(x) * two_pow_m64;
+		}
+	};
+
+	// Derives an unrelated stream id, used to hand forked work its own streams
+	inline uint64_t split_stream(uint64_t stream, uint64_t salt)
+	{
+		uint64_t z = stream + 0x9E3779B97F4A7C15ull * (salt + 1);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+}; // namespace wc
@@ -29,13 +29,14 @@ end
   	 $num $x * $x * :num set
   	 $den $counter 1 + * $counter 2 + * :den set
 
-	 $sol
 	 $alt $num *
 	 $den
-	 /
-	 + :sol set
+	 / :term var
+	 $sol $term + :sol set
 
   	 $counter 2 + :counter set
+
+	 $term abs $sol abs 1e-19 * <= break-if
   end-times
 
   $sol
@@ -74,8 +75,10 @@ end
 	 $num $x-sq * :num set
 	 $den 2 + :den set
 
-	 $num $alt * $den /
-	 $res + :res set
+	 $num $alt * $den / :term var
+	 $res $term + :res set
+
+	 $term abs $res abs 1e-19 * <= break-if
   end-times
 
   $res
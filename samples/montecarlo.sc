@@ -0,0 +1,11 @@
+; estimates pi by throwing darts at the unit square
+7 seed
+0 :inside var
+100000 :darts var
+
+$darts times
+  rand 2 ^ rand 2 ^ + 1 <=
+  $inside + :inside set
+end-times
+
+$inside $darts / 4 * top
@@ -0,0 +1,397 @@
+#include "wc.hpp"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <map>
+
+namespace wc
+{
+	namespace
+	{
+		volatile std::sig_atomic_t serve_stop = 0;
+
+		void on_stop_signal(int)
+		{
+			serve_stop = 1;
+		}
+
+		struct fd_guard {
+			int fd;
+			fd_guard(int fd) :fd(fd) {}
+			fd_guard(const fd_guard&) = delete;
+			~fd_guard() { if (fd >= 0) close(fd); }
+		};
+
+		sockaddr_un socket_address(std::string_view path)
+		{
+			sockaddr_un addr {};
+			addr.sun_family = AF_UNIX;
+
+			if (path.empty() || path.size() >= sizeof(addr.sun_path))
+				WC_EXCEPTION(init, "Socket path '{}' is empty or too long", path);
+			std::memcpy(addr.sun_path, path.data(), path.size());
+
+			return addr;
+		}
+
+		bool send_all(int fd, std::string_view what)
+		{
+			while (!what.empty())
+			{
+				const auto sent = send(fd, what.data(), what.size(), MSG_NOSIGNAL);
+				if (sent < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return false;
+				}
+				what.remove_prefix(sent);
+			}
+			return true;
+		}
+	}
+
+	void wtf_calculator::serve(std::string_view path)
+	{
+		// A longer request is refused and its connection closed, so that a
+		// client that never sends a newline cannot grow the server unbounded
+		constexpr size_t max_request = 1 << 20;
+
+		struct connection_t {
+			fd_guard fd;
+			std::unique_ptr<wtf_calculator> session;
+			std::string in, out;
+			unsigned lines = 0;
+			bool closing = false, want_out = false;
+		};
+
+		const auto addr = socket_address(path);
+		const std::string path_str(path);
+
+		fd_guard listener(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		if (listener.fd < 0)
+			WC_EXCEPTION(init, "Cannot create a socket: {}", std::strerror(errno));
+
+		if (bind(listener.fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+		{
+			// A socket nobody answers on is left over from an earlier run
+			const bool in_use = errno == EADDRINUSE;
+			struct stat st;
+			fd_guard probe(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+			const bool stale = in_use && stat(path_str.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+				connect(probe.fd, (const sockaddr*)&addr, sizeof(addr)) < 0;
+
+			if (!stale || unlink(path_str.c_str()) < 0 ||
+				bind(listener.fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+				WC_EXCEPTION(init, "Cannot bind to '{}': {}", path, std::strerror(errno));
+		}
+		if (listen(listener.fd, SOMAXCONN) < 0)
+			WC_EXCEPTION(init, "Cannot listen on '{}': {}", path, std::strerror(errno));
+
+		fd_guard epoll(epoll_create1(EPOLL_CLOEXEC));
+		if (epoll.fd < 0)
+			WC_EXCEPTION(init, "Cannot create an epoll instance: {}", std::strerror(errno));
+
+		epoll_event ev {};
+		ev.events = EPOLLIN;
+		ev.data.fd = listener.fd;
+		epoll_ctl(epoll.fd, EPOLL_CTL_ADD, listener.fd, &ev);
+
+		struct sigaction sa {}, old_int, old_term;
+		sa.sa_handler = on_stop_signal;
+		sigemptyset(&sa.sa_mask);
+		serve_stop = 0;
+		sigaction(SIGINT, &sa, &old_int);
+		sigaction(SIGTERM, &sa, &old_term);
+
+		std::map<int, connection_t> connections;
+		const auto source = intern_source("<session>");
+		verify_all();
+		uint64_t sessions = 0, requests = 0, latency_total = 0, latency_max = 0;
+
+		auto handle_line = [&](connection_t& conn, std::string_view line) {
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
+
+			auto& ins = *conn.session;
+			std::string output, error;
+			ins.location = {source, ++conn.lines};
+
+			const auto tp_start = std::chrono::steady_clock::now();
+			ins.capture = &output;
+			try
+			{
+				if (auto done = ins.parse(line); !done)
+				{
+					const auto& e = done.error();
+					if (e.type == wc::error_type::repl_quit)
+						conn.closing = true;
+					else
+						error = std::format("{}: {}", wc::error_type_str[static_cast<int>(e.type)], e.message());
+				}
+			}
+			catch (const std::exception& e)
+			{
+				error = std::format("internal: {}", e.what());
+			}
+			ins.capture = nullptr;
+			const uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - tp_start).count();
+
+			requests++;
+			latency_total += latency;
+			latency_max = std::max(latency_max, latency);
+
+			std::string_view rest = output;
+			while (!rest.empty())
+			{
+				const auto piece = rest.substr(0, rest.find('\n'));
+				rest.remove_prefix(std::min(rest.size(), piece.size() + 1));
+				std::format_to(std::back_inserter(conn.out), "| {}\n", piece);
+			}
+
+			if (conn.closing)
+				std::format_to(std::back_inserter(conn.out), "bye {}\n", latency);
+			else if (!error.empty())
+				std::format_to(std::back_inserter(conn.out), "error {} {}\n", latency, error);
+			else if (!ins.stack.empty() && ins.stack.back().type() == typeid(number_t))
+				std::format_to(std::back_inserter(conn.out), "ok {} {}\n", latency,
+							   std::any_cast<number_t>(ins.stack.back()));
+			else
+				std::format_to(std::back_inserter(conn.out), "ok {}\n", latency);
+		};
+
+		auto handle_input = [&](connection_t& conn) -> bool {
+			char buffer[1 << 16];
+			bool eof = false;
+
+			while (true)
+			{
+				const auto got = recv(conn.fd.fd, buffer, sizeof(buffer), 0);
+				if (got > 0)
+				{
+					conn.in.append(buffer, got);
+					// The rest is read once the lines so far are handled
+					if (conn.in.size() > max_request)
+						break;
+					continue;
+				}
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+					return false;
+
+				eof = got == 0;
+				break;
+			}
+
+			// Every complete line is a request; they may arrive many at a time
+			size_t begin = 0;
+			while (!conn.closing)
+			{
+				const auto end = conn.in.find('\n', begin);
+				if (end == std::string::npos)
+					break;
+				handle_line(conn, std::string_view(conn.in).substr(begin, end - begin));
+				begin = end + 1;
+			}
+			conn.in.erase(0, begin);
+
+			if (!conn.closing && conn.in.size() > max_request)
+			{
+				std::format_to(std::back_inserter(conn.out), "error 0 parse: Request longer than {} bytes\n",
+							   max_request);
+				conn.in.clear();
+				conn.closing = true;
+				return true;
+			}
+
+			if (eof)
+			{
+				if (!conn.closing && !conn.in.empty())
+					handle_line(conn, conn.in);
+				conn.in.clear();
+				conn.closing = true;
+			}
+			return true;
+		};
+
+		auto handle_output = [&](connection_t& conn) -> bool {
+			size_t sent_total = 0;
+			while (sent_total < conn.out.size())
+			{
+				const auto sent = send(conn.fd.fd, conn.out.data() + sent_total, conn.out.size() - sent_total,
+									   MSG_NOSIGNAL);
+				if (sent < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						break;
+					return false;
+				}
+				sent_total += sent;
+			}
+			conn.out.erase(0, sent_total);
+			return true;
+		};
+
+		std::array<epoll_event, 64> events;
+		while (!serve_stop)
+		{
+			const int count = epoll_wait(epoll.fd, events.data(), (int)events.size(), -1);
+			if (count < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				WC_EXCEPTION(init, "Cannot wait for events: {}", std::strerror(errno));
+			}
+
+			for (int e = 0; e < count; e++)
+			{
+				const int fd = events[e].data.fd;
+
+				if (fd == listener.fd)
+				{
+					int conn_fd;
+					while ((conn_fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+					{
+						auto& conn = connections.emplace(std::piecewise_construct, std::forward_as_tuple(conn_fd),
+														 std::forward_as_tuple(conn_fd)).first->second;
+						conn.session.reset(new wtf_calculator(this));
+						conn.session->rng_stream = ++sessions;
+						conn.session->rng.reseed(conn.session->rng_seed, conn.session->rng_stream);
+						if (profile)
+							conn.session->profile = std::make_unique<profiler>();
+						if (timer)
+							conn.session->timer = std::make_unique<timing>();
+						// Sessions take turns on this thread, so they share its ring
+						conn.session->trace_out = trace_out;
+						conn.session->update_tracing();
+
+						epoll_event conn_ev {};
+						conn_ev.events = EPOLLIN | EPOLLRDHUP;
+						conn_ev.data.fd = conn_fd;
+						epoll_ctl(epoll.fd, EPOLL_CTL_ADD, conn_fd, &conn_ev);
+					}
+					continue;
+				}
+
+				const auto it = connections.find(fd);
+				if (it == connections.end())
+					continue;
+				auto& conn = it->second;
+
+				bool healthy = !(events[e].events & EPOLLERR);
+				if (healthy && !conn.closing && (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+					healthy = handle_input(conn);
+				if (healthy)
+					healthy = handle_output(conn);
+
+				if (!healthy || (conn.closing && conn.out.empty()))
+				{
+					epoll_ctl(epoll.fd, EPOLL_CTL_DEL, fd, nullptr);
+					if (profile)
+						profile->merge(*conn.session->profile);
+					if (timer)
+						timer->merge(*conn.session->timer);
+					connections.erase(it);
+				}
+				else if (conn.want_out != !conn.out.empty())
+				{
+					conn.want_out = !conn.out.empty();
+
+					epoll_event conn_ev {};
+					conn_ev.events = (conn.closing ? 0 : EPOLLIN | EPOLLRDHUP) | (conn.want_out ? EPOLLOUT : 0);
+					conn_ev.data.fd = fd;
+					epoll_ctl(epoll.fd, EPOLL_CTL_MOD, fd, &conn_ev);
+				}
+			}
+		}
+
+		sigaction(SIGINT, &old_int, nullptr);
+		sigaction(SIGTERM, &old_term, nullptr);
+		unlink(path_str.c_str());
+
+		for (auto& [fd, conn] : connections)
+		{
+			if (profile)
+				profile->merge(*conn.session->profile);
+			if (timer)
+				timer->merge(*conn.session->timer);
+		}
+
+		if (is_time)
+		{
+			std::println(stderr, "Served {} requests over {} sessions, latency mean {} ns and max {} ns",
+						 requests, sessions, requests ? latency_total / requests : 0, latency_max);
+		}
+	}
+
+	void wtf_calculator::client(std::string_view path)
+	{
+		standard_output().flush();
+
+		const auto addr = socket_address(path);
+
+		fd_guard conn(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+		if (conn.fd < 0)
+			WC_EXCEPTION(init, "Cannot create a socket: {}", std::strerror(errno));
+
+		// Give a server that is still starting up a moment to appear
+		for (int attempt = 0; connect(conn.fd, (const sockaddr*)&addr, sizeof(addr)) < 0; attempt++)
+		{
+			if ((errno != ENOENT && errno != ECONNREFUSED) || attempt == 50)
+				WC_EXCEPTION(init, "Cannot connect to '{}': {}", path, std::strerror(errno));
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		// The sender waits on standard input and on this pipe, written to once
+		// the server hung up, so that it does not wait for more input to arrive
+		int wake[2];
+		if (pipe2(wake, O_CLOEXEC) != 0)
+			WC_EXCEPTION(init, "Cannot create a pipe: {}", std::strerror(errno));
+		fd_guard wake_read(wake[0]), wake_write(wake[1]);
+
+		// Requests are sent without waiting for replies
+		std::thread sender([&] {
+			char buffer[1 << 16];
+			while (true)
+			{
+				pollfd pfds[2] {{STDIN_FILENO, POLLIN, 0}, {wake_read.fd, POLLIN, 0}};
+				if (poll(pfds, 2, -1) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+				if (pfds[1].revents)
+					break;
+
+				const auto got = read(STDIN_FILENO, buffer, sizeof(buffer));
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got <= 0 || !send_all(conn.fd, std::string_view(buffer, got)))
+					break;
+			}
+			shutdown(conn.fd, SHUT_WR);
+		});
+
+		char buffer[1 << 16];
+		ssize_t got;
+		while ((got = recv(conn.fd, buffer, sizeof(buffer), 0)) > 0 || (got < 0 && errno == EINTR))
+			if (got > 0)
+				std::fwrite(buffer, 1, got, stdout);
+		std::fflush(stdout);
+
+		(void)!write(wake_write.fd, "", 1);
+		sender.join();
+	}
+}; // namespace wc
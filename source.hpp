@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+
+namespace wc
+{
+	// Where an instruction was compiled from. Source names are interned for the
+	// life of the process, so a location stays valid in every instance running it
+	struct location_t {
+		const std::string* source = nullptr;
+		unsigned line = 0;
+	};
+	using locations_t = std::vector<location_t>;
+
+	inline const std::string* intern_source(std::string_view name)
+	{
+		static std::mutex mutex;
+		static std::unordered_set<std::string> names;
+
+		std::lock_guard lock(mutex);
+		return &*names.emplace(name).first;
+	}
+}; // namespace wc
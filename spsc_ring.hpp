@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+
+namespace wc
+{
+	// Bounded lock-free single-producer single-consumer queue. The indices
+	// advance in steps of two; their low bit marks the owning side as closed,
+	// which also wakes the other side out of its wait
+	template<typename T>
+	class spsc_ring
+	{
+		std::vector<T> slots;
+		const size_t mask;
+
+		alignas(64) std::atomic<size_t> head {0};
+		alignas(64) std::atomic<size_t> tail {0};
+
+	public:
+		uint64_t producer_waits = 0, consumer_waits = 0;
+
+		explicit spsc_ring(size_t capacity)
+			:slots(std::bit_ceil(capacity)), mask(slots.size() - 1)
+		{
+		}
+
+		// Blocks while full. Returns false once the consumer has closed
+		bool push(T&& value)
+		{
+			const size_t t = tail.load(std::memory_order_relaxed);
+			while (true)
+			{
+				const size_t h = head.load(std::memory_order_acquire);
+				if (h & 1)
+					return false;
+				if ((t >> 1) - (h >> 1) < slots.size())
+					break;
+
+				producer_waits++;
+				head.wait(h, std::memory_order_acquire);
+			}
+
+			slots[(t >> 1) & mask] = std::move(value);
+			tail.store(t + 2, std::memory_order_release);
+			tail.notify_one();
+			return true;
+		}
+
+		// Blocks while empty. Returns false once the producer has closed and
+		// everything it pushed was consumed
+		bool pop(T& value)
+		{
+			const size_t h = head.load(std::memory_order_relaxed);
+			while (true)
+			{
+				const size_t t = tail.load(std::memory_order_acquire);
+				if ((t >> 1) != (h >> 1))
+					break;
+				if (t & 1)
+					return false;
+
+				consumer_waits++;
+				tail.wait(t, std::memory_order_acquire);
+			}
+
+			value = std::move(slots[(h >> 1) & mask]);
+			head.store(h + 2, std::memory_order_release);
+			head.notify_one();
+			return true;
+		}
+
+		void close_producer()
+		{
+			tail.fetch_or(1, std::memory_order_release);
+			tail.notify_one();
+		}
+
+		void close_consumer()
+		{
+			head.fetch_or(1, std::memory_order_release);
+			head.notify_one();
+		}
+	};
+}; // namespace wc
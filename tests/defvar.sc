@@ -0,0 +1,21 @@
+; computed when first read, then again only after an input changed
+2 :r var 1 :h var
+:area defvar $r $r * end
+:volume defvar $area $h * end
+$volume top
+3 :r set
+$volume top
+4 :h set
+$volume top
+; through the functions it calls
+1 :scale defun 10 * end
+:scaled defvar $r @scale end
+$scaled top
+1 :scale defun 100 * end
+$scaled top
+; loops of the expression last as long as the variable
+2 :a var
+:x defvar $a 3 times 2 * end-times end
+5 :a set
+1 5 times 1 + end-times pop
+$x top
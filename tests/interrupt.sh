@@ -0,0 +1,20 @@
+#!/bin/sh
+# Usage: interrupt.sh WC
+# Sends Ctrl-C to the REPL while it evaluates a line that would not end, and
+# compares what it printed with interrupt.out
+wc=$1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+mkfifo "$dir/in"
+
+"$wc" -r < "$dir/in" > "$dir/out" 2>&1 &
+pid=$!
+exec 3> "$dir/in"
+printf '1 2\n0 :i var 1e12 times $i 1 + :i set end-times\n' >&3
+sleep 1
+kill -INT $pid
+printf 'stack\n$i 0 > top\n' >&3
+exec 3>&-
+wait $pid
+
+diff -u interrupt.out "$dir/out"
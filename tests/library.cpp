@@ -0,0 +1,68 @@
+// Runs programs through libwc and checks what they return, throw and print
+#include "libwc.hpp"
+
+#include <optional>
+#include <print>
+
+namespace
+{
+	using number_t = wc::program::number_t;
+
+	int failures = 0;
+
+	void check(bool ok, std::string_view what)
+	{
+		if (!ok)
+		{
+			std::println(stderr, "FAIL: {}", what);
+			failures++;
+		}
+	}
+}
+
+int main()
+{
+	std::optional<wc::calculator> calc(std::in_place);
+	calc->load("2 :ratio defun / end 10 :scale varg 7 seed");
+
+	auto prog = calc->compile("@ratio $scale *");
+	check(prog.run(std::vector<number_t>{3, 2}) == std::vector<number_t>{15}, "run computes the expression");
+
+	std::vector<number_t> values;
+	const auto bad = prog.try_run(std::vector<number_t>{3, 0}, values);
+	check(!bad && bad.error().type == wc::error_type::exec, "try_run returns a division by zero");
+	check(prog.try_run(std::vector<number_t>{4, 2}, values).has_value() && values == std::vector<number_t>{20},
+		  "try_run goes on after an error");
+
+	bool thrown = false;
+	try
+	{
+		prog.run(std::vector<number_t>{1});
+	}
+	catch (const wc::exception&)
+	{
+		thrown = true;
+	}
+	check(thrown, "run throws when the function lacks an input");
+
+	check(!calc->try_compile(":x +").has_value(), "compiling rejects a string added to a number");
+
+	// Globals are taken as they were when compiling
+	calc->load("20 :scale set");
+	check(prog.run(std::vector<number_t>{1, 1}) == std::vector<number_t>{10}, "a program keeps its globals");
+
+	// Run N draws from stream N of the seed, so programs agree run by run
+	auto first = calc->compile("rand"), second = calc->compile("rand");
+	const auto a1 = first.run(), a2 = first.run(), b1 = second.run();
+	check(a1 == b1 && a1 != a2, "runs draw from streams of their own");
+
+	auto printing = calc->compile(":hello print 1");
+	printing.run();
+	check(printing.output() == "hello", "output holds what the run printed");
+
+	// The definitions outlive the calculator along with the programs using them
+	calc.reset();
+	check(prog.run(std::vector<number_t>{6, 3}) == std::vector<number_t>{20}, "a program outlives its calculator");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+; while runs its body once before testing what it left
+0 :i var
+while $i 1 + :i set $i 5 < end-while
+$i top
+; the first pass runs even when the condition is already false
+100 :j var
+while $j 1 + :j set 0 end-while
+$j top
+; until stops once the body leaves non-zero
+0 :k var
+until $k 2 + :k set $k 10 >= end-until
+$k top
+; break-if leaves the innermost loop only
+0 :n var 0 :m var
+3 times
+  10 times $m 1 + :m set $m 4 >= break-if end-times
+  0 :m set $n 1 + :n set
+end-times
+$n top
+1 :x var
+until $x 2 * :x set $x 100 > break-if 0 end-until
+$x top
@@ -0,0 +1,16 @@
+; a remembered call gives what the function computes
+1 :g defun 2 * end
+1 :f defun @g 1 + end
+16 :f memo
+3 @f top 3 @f top 4 @f top
+funcs
+; redefining what it calls empties the cache
+1 :g defun 10 * end
+3 @f top
+; and so does redefining it
+1 :f defun @g 2 + end
+3 @f top
+funcs
+; only pure functions are remembered
+1 :r defun rand + end
+16 :r memo
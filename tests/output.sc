@@ -0,0 +1,7 @@
+; the shortest form that reads back as the same number
+0.1 top 1 3 / top 2 0.5 ^ top
+1e300 top 1e-300 top 123456789012 top
+100 top 0 neg top 2 64 ^ top 1 2 64 ^ / top
+1 2 topb topb
+5 top
+:done println
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Usage: profile.sh WC
+# Profiles a script and compares the calls counted per operation, function
+# and loop, leaving out times and allocations, with profile.out
+wc=$1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+"$wc" --profile "$dir/profile.json" -e '1 :f defun 2 * end 0 3 times 1 @f + end-times top' \
+	> /dev/null 2>&1 || exit 1
+grep '"name"' "$dir/profile.json" | sed -E 's/, "(inclusive_ns|exclusive_ns|allocations)": [0-9]+//g' | diff -u profile.out -
@@ -0,0 +1,21 @@
+; reductions come out as the serial loop's, however the chunks were split
+0 :s var 0 :c var
+1000 :s:sum,c:sum ptimes $s 0.5 + :s set $c 1 + :c set end-ptimes
+$s top $c top
+0 :t var
+1000 times $t 0.5 + :t set end-times
+$t top
+1 :p var
+20 :p:product ptimes $p 2 * :p set end-ptimes
+$p top
+; its own variables are private to every iteration
+0 :n var
+100 :n:sum ptimes 3 :k var $k 1 + :k set $n $k + :n set end-ptimes
+$n top
+; the largest and smallest of many draws, the same on any number of workers
+0 :best var 7 seed
+1000 :best:max ptimes rand :r var $r $best > times $r :best set end-times end-ptimes
+$best top
+1 :least var
+1000 :least:min ptimes rand :r var $r $least < times $r :least set end-times end-ptimes
+$least top
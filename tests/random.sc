@@ -0,0 +1,5 @@
+; a seed always draws the same numbers
+7 seed rand top randn top 3 randv stack
+clear
+7 seed rand top
+8 seed rand top
@@ -0,0 +1,10 @@
+; a line's loops go once it is done, unless a function runs them
+1 3 times 2 * end-times top
+1 3 times 2 * end-times top
+1 :f defun 3 times 2 * end-times end
+1 5 times 1 + end-times top
+loops
+; identical bodies are compiled once
+1 :g defun 3 times 2 * end-times end
+2 @f top 2 @g top
+loops
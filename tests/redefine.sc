@@ -0,0 +1,8 @@
+; a function may replace another one
+0 :f defun 5 end
+0 :g defun :redefine_f.sc file @f end
+@g
+top
+; but not itself while it runs, as its frame still reads its body
+0 :f defun :redefine_f.sc file 1 end
+@f
@@ -0,0 +1,2 @@
+; read by redefine.sc from inside the functions it replaces
+0 :f defun 7 end
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Usage: run.sh NAME WC [ARGUMENT...]
+# Runs WC with the arguments, NAME.in as standard input when there is one,
+# and compares its standard output with NAME.out and its standard error with
+# NAME.err, which has to stay empty when there is no such file
+name=$1 wc=$2
+shift 2
+
+input=/dev/null
+[ -f "$name.in" ] && input=$name.in
+errors=$(mktemp) || exit 1
+trap 'rm -f "$errors"' EXIT
+
+out=$("$wc" "$@" < "$input" 2> "$errors")
+status=0
+if [ "$out" != "$(cat "$name.out")" ]; then
+	printf '%s\n' "$out" | diff -u "$name.out" - | sed "s|^+++ -|+++ $name|"
+	status=1
+fi
+expected_errors=/dev/null
+[ -f "$name.err" ] && expected_errors=$name.err
+if [ "$(cat "$errors")" != "$(cat "$expected_errors")" ]; then
+	diff -u "$expected_errors" "$errors"
+	status=1
+fi
+exit $status
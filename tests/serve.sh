@@ -0,0 +1,30 @@
+#!/bin/sh
+# Usage: serve.sh WC
+# Runs a server, sends it requests through clients and compares the replies,
+# latencies left out, with serve.out
+wc=$1
+dir=$(mktemp -d) || exit 1
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+
+"$wc" -e '1 :double defun 2 * end' --serve "$dir/socket" &
+server=$!
+
+{
+	# Sessions share the definitions and keep their own stacks and variables
+	printf '3 @double top\n1 :x var\nfoo\n$x 1 + top\nquit\n1 top\n' | "$wc" -c "$dir/socket"
+	printf '$x\nstack\n' | "$wc" -c "$dir/socket"
+
+	# A request that never ends is refused
+	head -c 2000000 /dev/zero | tr '\0' '1' | "$wc" -c "$dir/socket"
+
+	# The client ends once the server hangs up, though its input goes on
+	mkfifo "$dir/in"
+	"$wc" -c "$dir/socket" < "$dir/in" &
+	client=$!
+	exec 3> "$dir/in"
+	printf '2 top\nquit\n' >&3
+	wait $client
+	exec 3>&-
+} | sed -E 's/^(ok|error|bye) [0-9]+/\1 NS/' > "$dir/out"
+
+diff -u serve.out "$dir/out"
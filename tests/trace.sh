@@ -0,0 +1,18 @@
+#!/bin/sh
+# Usage: trace.sh WC
+# Records a run with --trace and compares the decoded records with what
+# --verbose prints for the same run
+wc=$1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+program='1 :x var 2 times $x 1 + :x set end-times 1 :f defun 2 * end $x @f top'
+"$wc" --verbose -e "$program" > /dev/null 2> "$dir/verbose"
+"$wc" --trace "$dir/trace" -e "$program" > /dev/null &&
+	"$wc" --decode-trace "$dir/trace" > "$dir/decoded" || exit 1
+
+# A trace that cannot be created is an error of its own
+"$wc" --trace "$dir/missing/trace" -e 1 2> "$dir/error" && exit 1
+grep -q "Cannot create the trace" "$dir/error" || exit 1
+
+[ -s "$dir/verbose" ] && diff -u "$dir/verbose" "$dir/decoded"
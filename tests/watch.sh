@@ -0,0 +1,23 @@
+#!/bin/sh
+# Usage: watch.sh WC
+# Edits a file under --watch and compares what ran again with watch.out
+wc=$1
+dir=$(mktemp -d) || exit 1
+trap 'kill $watcher 2>/dev/null; rm -rf "$dir"' EXIT
+
+printf '1 :f defun 2 * end\n3 @f top\n10 top\n' > "$dir/model.sc"
+"$wc" --watch -f "$dir/model.sc" > "$dir/out" 2>&1 &
+watcher=$!
+sleep 1
+
+# Only the redefined function and what calls it run again
+printf '1 :f defun 3 * end\n3 @f top\n10 top\n' > "$dir/model.sc"
+sleep 1
+
+# Errors are shown with where they are, and the watch goes on
+printf '1 :f defun 3 * end\n3 @f top\nfoo\n' > "$dir/model.sc"
+sleep 1
+kill -INT $watcher
+wait $watcher
+
+sed "s|$dir/||" "$dir/out" | diff -u watch.out -
@@ -0,0 +1,137 @@
+#include "thread_pool.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace wc
+{
+	thread_pool::thread_pool(unsigned workers)
+	{
+		workers = std::max(workers, 1u);
+
+		for (unsigned i = 0; i < workers; i++)
+			queues.push_back(std::make_unique<queue_t>());
+		for (unsigned i = 1; i < workers; i++)
+			threads.emplace_back(&thread_pool::thread_main, this, i);
+	}
+
+	thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		cv_start.notify_all();
+
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	void thread_pool::parallel_for(size_t count, size_t chunk, const job_t& job)
+	{
+		if (count == 0)
+			return;
+		chunk = std::max<size_t>(chunk, 1);
+
+		{
+			std::lock_guard lock(mutex);
+			if (busy)
+				throw std::logic_error("thread_pool::parallel_for is not reentrant");
+			busy = true;
+
+			size_t k = 0;
+			for (size_t begin = 0; begin < count; begin += chunk, k++)
+			{
+				auto& queue = *queues[k % queues.size()];
+				std::lock_guard lock_queue(queue.mutex);
+				queue.ranges.push_back({begin, std::min(begin + chunk, count)});
+			}
+
+			this->job = &job;
+			running = (unsigned)threads.size();
+			generation++;
+		}
+		cv_start.notify_all();
+
+		drain(0);
+
+		std::exception_ptr e;
+		{
+			std::unique_lock lock(mutex);
+			cv_done.wait(lock, [this] { return running == 0; });
+
+			this->job = nullptr;
+			busy = false;
+			std::swap(e, error);
+		}
+		if (e)
+			std::rethrow_exception(e);
+	}
+
+	void thread_pool::thread_main(unsigned worker)
+	{
+		size_t seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock lock(mutex);
+				cv_start.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+
+			drain(worker);
+
+			std::lock_guard lock(mutex);
+			if (--running == 0)
+				cv_done.notify_all();
+		}
+	}
+
+	void thread_pool::drain(unsigned worker)
+	{
+		std::pair<size_t, size_t> range;
+		while (pop(worker, range))
+		{
+			try
+			{
+				(*job)(worker, range.first, range.second);
+			}
+			catch (...)
+			{
+				std::lock_guard lock(mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	}
+
+	bool thread_pool::pop(unsigned worker, std::pair<size_t, size_t>& range)
+	{
+		{
+			auto& own = *queues[worker];
+			std::lock_guard lock(own.mutex);
+			if (!own.ranges.empty())
+			{
+				range = own.ranges.front();
+				own.ranges.pop_front();
+				return true;
+			}
+		}
+
+		for (unsigned k = 1; k < queues.size(); k++)
+		{
+			auto& victim = *queues[(worker + k) % queues.size()];
+			std::lock_guard lock(victim.mutex);
+			if (!victim.ranges.empty())
+			{
+				range = victim.ranges.back();
+				victim.ranges.pop_back();
+				return true;
+			}
+		}
+
+		return false;
+	}
+}; // namespace wc
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstddef>
+
+namespace wc
+{
+	// Fixed set of workers running parallel_for jobs. Each worker owns a queue
+	// of index ranges and steals from the back of the others once its own runs dry
+	class thread_pool
+	{
+	public:
+		using job_t = std::function<void(unsigned worker, size_t begin, size_t end)>;
+
+	private:
+		struct queue_t {
+			std::mutex mutex;
+			std::deque<std::pair<size_t, size_t>> ranges;
+		};
+
+		std::vector<std::thread> threads;
+		std::vector<std::unique_ptr<queue_t>> queues;
+
+		std::mutex mutex;
+		std::condition_variable cv_start, cv_done;
+		const job_t* job = nullptr;
+		size_t generation = 0;
+		unsigned running = 0;
+		bool stopping = false, busy = false;
+		std::exception_ptr error;
+
+	public:
+		explicit thread_pool(unsigned workers);
+		~thread_pool();
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		unsigned size() const { return (unsigned)queues.size(); }
+
+		// Runs job over [0, count) in ranges of at most chunk indices and
+		// blocks until all of them are done. The calling thread is worker 0.
+		// The first exception thrown by the job is rethrown here
+		void parallel_for(size_t count, size_t chunk, const job_t& job);
+
+	private:
+		void thread_main(unsigned worker);
+		void drain(unsigned worker);
+		bool pop(unsigned worker, std::pair<size_t, size_t>& range);
+	};
+}; // namespace wc
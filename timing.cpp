@@ -0,0 +1,244 @@
+#include "timing.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <print>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace wc
+{
+	namespace
+	{
+		constexpr std::array<std::pair<uint32_t, uint64_t>, perf_counters::count> events {{
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+				{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+			}
+		};
+
+		uint64_t now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+	}
+
+	perf_counters::perf_counters()
+	{
+		fds.fill(-1);
+		slots.fill(-1);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			perf_event_attr attr {};
+			attr.size = sizeof(attr);
+			attr.type = events[i].first;
+			attr.config = events[i].second;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+			if (fd < 0)
+			{
+				if (failure.empty())
+					failure = std::format("{}: {}", names[i], std::strerror(errno));
+				continue;
+			}
+
+			if (leader < 0)
+				leader = fd;
+			fds[i] = fd;
+			slots[i] = (int)opened++;
+		}
+	}
+
+	perf_counters::~perf_counters()
+	{
+		for (const int fd : fds)
+			if (fd >= 0)
+				close(fd);
+	}
+
+	perf_counters::values_t perf_counters::read() const
+	{
+		values_t values {};
+		if (leader < 0)
+			return values;
+
+		// Number of events, time enabled and time running, then the values
+		std::array<uint64_t, 3 + count> buffer {};
+		if (::read(leader, buffer.data(), sizeof(buffer)) < 0)
+			return values;
+
+		// Scaled up for the time the group was multiplexed out
+		const auto enabled = buffer[1], running = buffer[2];
+		for (size_t i = 0; i < count; i++)
+		{
+			if (slots[i] < 0)
+				continue;
+
+			values[i] = buffer[3 + slots[i]];
+			if (running > 0 && running < enabled)
+				values[i] = (uint64_t)((long double)values[i] * enabled / running);
+		}
+		return values;
+	}
+
+	timing::mark_t timing::mark() const
+	{
+		return {now_ns(), counters ? counters->read() : perf_counters::values_t {}};
+	}
+
+	void timing::add(tally_t& to, const mark_t& from, const mark_t& until)
+	{
+		to.count++;
+		to.wall_ns += until.wall_ns - from.wall_ns;
+		for (size_t i = 0; i < perf_counters::count; i++)
+			to.counters[i] += until.counters[i] - from.counters[i];
+	}
+
+	void timing::enable_counters()
+	{
+		counters = std::make_unique<perf_counters>();
+
+		bool any = false;
+		for (size_t i = 0; i < perf_counters::count; i++)
+			any = any || counters->available(i);
+
+		if (!any)
+			std::println(stderr, "Performance counters are unavailable ({}), timing the wall clock only",
+						 counters->unavailable());
+		else if (!counters->unavailable().empty())
+			std::println(stderr, "Some performance counters are unavailable ({})", counters->unavailable());
+	}
+
+	void timing::begin_line()
+	{
+		if (split_phases && depth++ == 0)
+			last = mark();
+	}
+
+	void timing::lap(phase_type phase)
+	{
+		if (!split_phases || depth != 1)
+			return;
+
+		const auto now = mark();
+		add(phases[static_cast<int>(phase)], last, now);
+		if (in_item)
+			add(items.back().second[static_cast<int>(phase)], last, now);
+		last = now;
+	}
+
+	void timing::tic(std::string_view label)
+	{
+		started.insert_or_assign(std::string(label), mark());
+	}
+
+	result<> timing::toc(std::string_view label)
+	{
+		const auto it = started.find(label);
+		if (it == started.end())
+			return WC_ERROR(exec, "No tic started label '{}'", label);
+
+		add(regions[it->first], it->second, mark());
+		started.erase(it);
+		return {};
+	}
+
+	void timing::merge(timing& other)
+	{
+		for (const auto& [label, tally] : other.regions)
+		{
+			auto& to = regions[label];
+			to.count += tally.count;
+			to.wall_ns += tally.wall_ns;
+		}
+
+		other.regions.clear();
+		other.started.clear();
+	}
+
+	void timing::report(std::FILE* out) const
+	{
+		std::print(out, "{:<24} {:>10} {:>12}", split_phases ? "phase or label" : "label", "count", "wall ms");
+		if (counters)
+			for (const auto name : perf_counters::names)
+				std::print(out, " {:>14}", name);
+		std::println(out, "");
+
+		auto row = [&](std::string_view name, const tally_t& tally) {
+			std::print(out, "{:<24} {:>10} {:>12.3f}", name, tally.count, tally.wall_ns / 1e6);
+			for (size_t i = 0; counters && i < perf_counters::count; i++)
+			{
+				if (counters->available(i))
+					std::print(out, " {:>14}", tally.counters[i]);
+				else
+					std::print(out, " {:>14}", "-");
+			}
+			std::println(out, "");
+		};
+
+		if (split_phases)
+		{
+			for (const auto& [name, item] : items)
+			{
+				std::println(out, "{}", name);
+				for (size_t i = 0; i < item.size(); i++)
+					row(std::format("  {}", phase_type_str[i]), item[i]);
+			}
+			for (size_t i = 0; i < phases.size(); i++)
+				row(std::format("total {}", phase_type_str[i]), phases[i]);
+		}
+		for (const auto& [label, tally] : regions)
+			row(label, tally);
+	}
+
+	void timing::write_json(std::ostream& os) const
+	{
+		auto object = [&](const tally_t& tally) {
+			std::string out = std::format("{{\"count\": {}, \"wall_ns\": {}", tally.count, tally.wall_ns);
+			for (size_t i = 0; counters && i < perf_counters::count; i++)
+			{
+				if (counters->available(i))
+					std::format_to(std::back_inserter(out), ", \"{}\": {}", perf_counters::names[i], tally.counters[i]);
+				else
+					std::format_to(std::back_inserter(out), ", \"{}\": null", perf_counters::names[i]);
+			}
+			return out + "}";
+		};
+
+		os << "{\n  \"unavailable\": " << (counters && !counters->unavailable().empty() ?
+											json_string(counters->unavailable()) : "null");
+
+		auto group = [&](const phases_t& of, std::string_view indent) {
+			std::string out = "{";
+			for (size_t i = 0; i < of.size(); i++)
+				out += std::format("{}\n{}  \"{}\": {}", i ? "," : "", indent, phase_type_str[i], object(of[i]));
+			return out + std::format("\n{}}}", indent);
+		};
+
+		os << ",\n  \"phases\": " << group(phases, "  ");
+
+		os << ",\n  \"items\": [";
+		for (size_t i = 0; i < items.size(); i++)
+			os << (i ? "," : "") << "\n    {\"name\": " << json_string(items[i].first)
+			   << ", \"phases\": " << group(items[i].second, "    ") << "}";
+
+		os << "\n  ],\n  \"regions\": {";
+		bool first = true;
+		for (const auto& [label, tally] : regions)
+		{
+			os << (first ? "" : ",") << "\n    " << json_string(label) << ": " << object(tally);
+			first = false;
+		}
+		os << "\n  }\n}\n";
+	}
+}; // namespace wc
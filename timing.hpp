@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <ostream>
+
+#include "utility.hpp"
+
+namespace wc
+{
+	// Hardware and software counters of the thread that opened them, read
+	// together as one group. Events the machine or the kernel does not offer
+	// are left out; reading then gives 0 for them
+	class perf_counters
+	{
+	public:
+		static constexpr size_t count = 5;
+		static constexpr std::array<std::string_view, count> names {
+			"cycles", "instructions", "branch-misses", "cache-misses", "task-clock"
+		};
+		using values_t = std::array<uint64_t, count>;
+
+	private:
+		int leader = -1;
+		std::array<int, count> fds;
+		std::array<int, count> slots;
+		size_t opened = 0;
+		std::string failure;
+
+	public:
+		perf_counters();
+		perf_counters(const perf_counters&) = delete;
+		~perf_counters();
+
+		bool available(size_t event) const { return fds[event] >= 0; }
+		// Why the first event missing could not be opened, empty if none is
+		const std::string& unavailable() const { return failure; }
+
+		values_t read() const;
+	};
+
+	enum class phase_type { parse, compile, execute };
+	static constexpr std::array<std::string_view, 3> phase_type_str {"parse", "compile", "execute"};
+
+	// Wall time, and counters with --perf-counters, accumulated per phase of the
+	// lines evaluated, per work item and per tic/toc label
+	class timing
+	{
+	public:
+		struct tally_t {
+			uint64_t count = 0, wall_ns = 0;
+			perf_counters::values_t counters {};
+		};
+		using phases_t = std::array<tally_t, 3>;
+
+	private:
+		struct mark_t {
+			uint64_t wall_ns;
+			perf_counters::values_t counters;
+		};
+
+		std::unique_ptr<perf_counters> counters;
+		mark_t last {};
+		unsigned depth = 0;
+		bool split_phases;
+
+		phases_t phases;
+		std::vector<std::pair<std::string, phases_t>> items;
+		bool in_item = false;
+		std::map<std::string, mark_t, std::less<>> started;
+		std::map<std::string, tally_t, std::less<>> regions;
+
+		mark_t mark() const;
+		static void add(tally_t& to, const mark_t& from, const mark_t& until);
+
+	public:
+		// Without phases only the tic/toc regions are timed
+		explicit timing(bool phases = false) :split_phases(phases) {}
+
+		// Counters are opened by the calling thread and count only it
+		void enable_counters();
+		bool has_counters() const { return counters != nullptr; }
+
+		// Only the outermost line is split into phases; lines it runs, e.g.
+		// through file, count as its execution
+		void begin_line();
+		void lap(phase_type phase);
+		void end_line()
+		{
+			if (split_phases)
+				depth--;
+		}
+
+		// Lines evaluated meanwhile also count towards the item, e.g. one -e or -f
+		void begin_item(std::string name)
+		{
+			items.emplace_back(std::move(name), phases_t {});
+			in_item = true;
+		}
+		void end_item() { in_item = false; }
+
+		void tic(std::string_view label);
+		result<> toc(std::string_view label);
+
+		// Takes the regions a worker measured; its counters are not comparable
+		void merge(timing& other);
+
+		bool has_regions() const { return !regions.empty(); }
+
+		void report(std::FILE* out) const;
+		void write_json(std::ostream& os) const;
+	};
+}; // namespace wc
@@ -0,0 +1,142 @@
+#include "trace.hpp"
+#include "utility.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <print>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace wc
+{
+	namespace
+	{
+		constexpr char magic[8] = {'W', 'C', 'T', 'R', 'A', 'C', 'E', '\0'};
+		constexpr uint32_t version = 1;
+	}
+
+	std::string trace_text(const trace_record& r)
+	{
+		const std::string_view op(r.op, strnlen(r.op, sizeof(r.op)));
+		const auto& v = r.values;
+
+		std::string name(r.named.name, strnlen(r.named.name, sizeof(r.named.name)));
+		if (r.truncated)
+			name += "...";
+
+		switch (r.kind)
+		{
+		case trace_kind::binary:
+			return std::format("{}> {} = {} {} {}", r.depth, v[0], v[1], op, v[2]);
+		case trace_kind::unary:
+			if (op == "neg")
+				return std::format("{}> {} = -({})", r.depth, v[0], v[1]);
+			if (op == "abs")
+				return std::format("{}> {} = |{}|", r.depth, v[0], v[1]);
+			return std::format("{}> {} = {}({})", r.depth, v[0], op, v[1]);
+		case trace_kind::nullary:
+			return std::format("{}> {} = {}", r.depth, v[0], op);
+		case trace_kind::replace:
+			return std::format("{}> replace {} > {}", r.depth, v[0], v[1]);
+		case trace_kind::swap:
+			return std::format("{}> swap {} <> {}", r.depth, v[0], v[1]);
+		case trace_kind::pop:
+			return std::format("{}> pop {}", r.depth, v[0]);
+		case trace_kind::randv:
+			return std::format("{}> randv {}", r.depth, r.count);
+		case trace_kind::seed:
+			return std::format("{}> seed {} on stream {}", r.depth, v[0], r.count);
+		case trace_kind::var:
+		case trace_kind::set:
+		case trace_kind::varg:
+			return std::format("{}> {}{}${} = {}", r.depth, r.kind == trace_kind::set ? "" : "new ",
+							   r.scope ? std::format("local:{} ", r.count) : "", name, r.named.value);
+		case trace_kind::del:
+			return std::format("{}> del ${}", r.depth, name);
+		case trace_kind::begin:
+			return std::format("{}> begin {} - {},{}", r.depth, name, r.scope, r.count);
+		case trace_kind::end:
+			// The value holds how many locals the scope freed
+			return std::format("{}> end {} - {},{}{}", r.depth, name, r.scope, r.count,
+							   r.named.value > 0 ? std::format(" - freed {} variables", r.named.value) : "");
+		case trace_kind::break_loop:
+			return std::format("{}> break {}", r.depth, name);
+		}
+		return std::format("{}> unknown record {}", r.depth, static_cast<int>(r.kind));
+	}
+
+	trace_ring::trace_ring(const std::string& path, uint64_t capacity)
+		:mask(capacity - 1)
+	{
+		length = sizeof(header_t) + capacity * sizeof(trace_record);
+
+		// The mapping outlives the descriptor, which is closed before anything is thrown
+		const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			WC_EXCEPTION(file, "Cannot create the trace '{}': {}", path, std::strerror(errno));
+		if (ftruncate(fd, static_cast<off_t>(length)) != 0)
+		{
+			const int failure = errno;
+			close(fd);
+			WC_EXCEPTION(file, "Cannot create the trace '{}': {}", path, std::strerror(failure));
+		}
+
+		void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		const int failure = errno;
+		close(fd);
+		if (mapped == MAP_FAILED)
+			WC_EXCEPTION(file, "Cannot map the trace '{}': {}", path, std::strerror(failure));
+
+		header = static_cast<header_t*>(mapped);
+		records = reinterpret_cast<trace_record*>(header + 1);
+		std::copy_n(magic, sizeof(magic), header->magic);
+		header->record_size = sizeof(trace_record);
+		header->version = version;
+		header->capacity = capacity;
+		header->written = 0;
+	}
+
+	trace_ring::~trace_ring()
+	{
+		if (header)
+			munmap(header, length);
+	}
+
+	void trace_ring::decode(const std::string& path, std::FILE* out)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st {};
+		if (fd < 0 || fstat(fd, &st) != 0)
+			WC_EXCEPTION(file, "Cannot open the trace '{}': {}", path, std::strerror(errno));
+
+		const size_t size = static_cast<size_t>(st.st_size);
+		void* mapped = size >= sizeof(header_t) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (mapped == MAP_FAILED)
+			WC_EXCEPTION(file, "'{}' is not a trace", path);
+
+		const auto header = static_cast<const header_t*>(mapped);
+		const auto records = reinterpret_cast<const trace_record*>(header + 1);
+		const bool valid = std::equal(magic, magic + sizeof(magic), header->magic) &&
+			header->version == version && header->record_size == sizeof(trace_record) &&
+			header->capacity > 0 && size >= sizeof(header_t) + header->capacity * sizeof(trace_record);
+		if (!valid)
+		{
+			munmap(mapped, size);
+			WC_EXCEPTION(file, "'{}' is not a trace of this version", path);
+		}
+
+		const auto written = header->written;
+		const auto first = written > header->capacity ? written - header->capacity : 0;
+		if (first > 0)
+			std::println(out, "... {} earlier records were overwritten", first);
+		for (auto i = first; i < written; i++)
+			std::println(out, "{}", trace_text(records[i % header->capacity]));
+
+		munmap(mapped, size);
+	}
+}; // namespace wc
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <initializer_list>
+#include <cstdio>
+#include <cstdint>
+
+namespace wc
+{
+	enum class trace_kind : uint8_t {
+		binary, unary, nullary, replace, swap, pop, randv, seed,
+		var, set, varg, del, begin, end, break_loop
+	};
+
+	// One event of --trace or --verbose, written as it is and turned into text
+	// only when shown. Names longer than the record holds are cut short
+	struct trace_record {
+		struct named_t {
+			long double value;
+			char name[32];
+		};
+
+		trace_kind kind;
+		bool truncated;
+		// Of begin and end, and whether var and set found a local
+		uint16_t scope;
+		uint32_t depth;
+		union {
+			uint64_t count;
+			char op[8];
+		};
+		union {
+			long double values[3];
+			named_t named;
+		};
+	};
+	static_assert(sizeof(trace_record) == 64);
+
+	// The result of an operation, then its operands from the bottom
+	inline trace_record trace_values(trace_kind kind, std::string_view op, size_t depth,
+									 std::initializer_list<long double> values)
+	{
+		trace_record record {};
+		record.kind = kind;
+		record.depth = static_cast<uint32_t>(depth);
+		std::copy_n(op.begin(), std::min(op.size(), sizeof(record.op)), record.op);
+		std::copy(values.begin(), values.end(), record.values);
+		return record;
+	}
+
+	inline trace_record trace_named(trace_kind kind, size_t depth, std::string_view name, long double value = 0,
+									uint64_t count = 0, uint16_t scope = 0)
+	{
+		trace_record record {};
+		record.kind = kind;
+		record.depth = static_cast<uint32_t>(depth);
+		record.scope = scope;
+		record.count = count;
+		record.named.value = value;
+		record.truncated = name.size() >= sizeof(record.named.name);
+		std::copy_n(name.begin(), std::min(name.size(), sizeof(record.named.name) - 1), record.named.name);
+		return record;
+	}
+
+	// The line --verbose prints for the record
+	std::string trace_text(const trace_record& record);
+
+	// The latest records of one thread in a file it maps, so that they outlive
+	// a crash. Once full, the oldest records are overwritten
+	class trace_ring
+	{
+		struct header_t {
+			char magic[8];
+			uint32_t record_size, version;
+			uint64_t capacity, written;
+			char reserved[32];
+		};
+		static_assert(sizeof(header_t) == sizeof(trace_record));
+
+		size_t length = 0;
+		header_t* header = nullptr;
+		trace_record* records = nullptr;
+		uint64_t mask = 0;
+
+	public:
+		// 16 MiB of records, a power of two
+		static constexpr uint64_t default_capacity = 1 << 18;
+
+		explicit trace_ring(const std::string& path, uint64_t capacity = default_capacity);
+		trace_ring(const trace_ring&) = delete;
+		~trace_ring();
+
+		void push(const trace_record& record)
+		{
+			records[header->written & mask] = record;
+			header->written++;
+		}
+
+		// Writes the records of a trace file as --verbose would have, oldest first
+		static void decode(const std::string& path, std::FILE* out);
+	};
+}; // namespace wc
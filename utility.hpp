@@ -1,15 +1,23 @@
 #pragma once
 
 #include <exception>
+#include <stdexcept>
+#include <string>
 #include <string_view>
 #include <array>
 #include <format>
+#include <variant>
+#include <expected>
+#include <type_traits>
+#include <iterator>
 
 #define WC_EXCEPTION(type, ...) {						\
 		auto msg = std::format(__VA_ARGS__);			\
 		throw wc::exception(msg, wc::error_type::type);	\
 	}
 
+#define WC_ERROR(type, ...) std::unexpected(wc::error(wc::error_type::type, __VA_ARGS__))
+
 #define WC_STD_EXCEPTION(...) {					\
 		auto msg = std::format(__VA_ARGS__);	\
 		throw std::runtime_error(msg);			\
@@ -24,16 +32,18 @@ namespace wc
 		eval,
 		exec,
 		file,
+		limit,
 		repl_quit
 	};
 
-	static constexpr std::array<std::string_view, 7> error_type_str
+	static constexpr std::array<std::string_view, 8> error_type_str
 	{
 		"init", "init_help",
 		"parse",
 		"eval",
 		"exec",
 		"file",
+		"limit",
 		"repl_quit"
 	};
 
@@ -47,4 +57,91 @@ namespace wc
 		{
 		}
 	};
+
+	// An error passed by value through the evaluator instead of thrown. Only the
+	// format string and its arguments are kept; the message is built on demand,
+	// which a rejected record whose message nobody reads never does
+	class error
+	{
+		using arg_t = std::variant<std::monostate, std::string, long double, long long, unsigned long long>;
+
+		std::string_view fmt;
+		std::array<arg_t, 3> args;
+
+		template<typename T>
+		static arg_t make_arg(T&& value)
+		{
+			using U = std::remove_cvref_t<T>;
+			if constexpr (std::is_same_v<U, char>)
+				return std::string(1, value);
+			else if constexpr (std::is_floating_point_v<U>)
+				return static_cast<long double>(value);
+			else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+				return static_cast<long long>(value);
+			else if constexpr (std::is_integral_v<U>)
+				return static_cast<unsigned long long>(value);
+			else
+				return std::string(std::forward<T>(value));
+		}
+
+	public:
+		error_type type;
+
+		template<typename... Args>
+		error(error_type type, std::format_string<Args...> fmt, Args&&... args)
+			:fmt(fmt.get()), args{make_arg(std::forward<Args>(args))...}, type(type)
+		{
+			static_assert(sizeof...(Args) <= 3, "wc::error keeps at most 3 arguments");
+		}
+
+		std::string message() const
+		{
+			std::array<std::string, 3> parts;
+			for (size_t i = 0; i < args.size(); i++)
+			{
+				parts[i] = std::visit([](const auto& arg) -> std::string {
+					if constexpr (std::is_same_v<std::remove_cvref_t<decltype(arg)>, std::monostate>)
+						return {};
+					else
+						return std::format("{}", arg);
+				}, args[i]);
+			}
+
+			return std::vformat(fmt, std::make_format_args(parts[0], parts[1], parts[2]));
+		}
+
+		[[noreturn]] void raise() const
+		{
+			throw wc::exception(message(), type);
+		}
+	};
+
+	// Quoted and escaped for JSON output
+	inline std::string json_string(std::string_view what)
+	{
+		std::string out = "\"";
+		for (const char c : what)
+		{
+			if (c == '"' || c == '\\')
+				out += '\\';
+			if (static_cast<unsigned char>(c) < 0x20)
+				std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<int>(c));
+			else
+				out += c;
+		}
+		return out + '"';
+	}
+
+	template<typename T = void>
+	using result = std::expected<T, error>;
+
+	// Where the command line expects exceptions, errors are turned back into them
+	template<typename T>
+	T unwrap(result<T>&& r)
+	{
+		if (!r)
+			r.error().raise();
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*r);
+	}
 }; // namespace wc
@@ -0,0 +1,459 @@
+#include "wc.hpp"
+
+namespace wc
+{
+	namespace
+	{
+		std::string_view type_str(operand_type type)
+		{
+			return type == operand_type::string ? "string" : "number";
+		}
+
+		// Operations whose result depends on their operands only. Assigning is
+		// pure as long as the variable is one of the function's own
+		constexpr std::array<std::string_view, 26> pure_operations {
+			"+", "-", "*", "/", "^", "replace", "swap", "pop", "<", ">", "<=", ">=", "=", "!=",
+			"neg", "abs", "sin", "cos", "floor", "ceil", "var", "set", "break-if",
+			"_use_times", "_use_while", "_use_until"
+		};
+
+		// A loop running any number of times leaves the stack as it found it
+		bool balanced(const effect_t& effect)
+		{
+			const auto& [needs, leaves, exact, breaks] = effect;
+			return needs.size() == leaves.size() && std::equal(needs.begin(), needs.end(), leaves.rbegin());
+		}
+	}
+
+	uint64_t wtf_calculator::stamp() const
+	{
+		return definitions + (library ? library->stamp() : 0);
+	}
+
+	// Follows the types of the elements a block pushes and takes. Entry elements
+	// are unknown unless the block is about to run on the current stack, in which
+	// case running short or taking the wrong type is an error already. Otherwise
+	// only the types of elements the block pushed itself are errors
+	result<verdict_t> wtf_calculator::verify(const stack_t& body, frame_type type, const stack_t* entry)
+	{
+		verdict_t verdict;
+		verdict.epoch = stamp();
+		auto& [needs, leaves, exact, breaks] = verdict.effect;
+
+		// What a line defines is not known until it ran
+		if (entry && !current_eval_function.empty())
+		{
+			exact = false;
+			return verdict;
+		}
+
+		// Nothing lies below the pushed elements once the stack was cleared
+		bool floor = false;
+
+		// Elements left to take, if that is known
+		auto available = [&]() -> std::optional<size_t> {
+			if (floor)
+				return leaves.size();
+			if (entry)
+				return leaves.size() + entry->size() - needs.size();
+			return std::nullopt;
+		};
+
+		// Type of the element depth below the top; empty if it is not a number or a string
+		auto type_at = [&](size_t depth, operand_type want) -> std::optional<operand_type> {
+			if (depth < leaves.size())
+				return leaves[leaves.size() - depth - 1];
+			if (!entry)
+				return want;
+
+			const auto& elem = (*entry)[entry->size() - (needs.size() + depth - leaves.size()) - 1];
+			if (elem.type() == typeid(number_t))
+				return operand_type::number;
+			if (elem.type() == typeid(std::string))
+				return operand_type::string;
+			return std::nullopt;
+		};
+
+		auto take = [&](size_t count, auto&& want_at) {
+			const size_t from_leaves = std::min(count, leaves.size());
+			for (size_t depth = from_leaves; depth < count; depth++)
+				needs.push_back(want_at(depth));
+			leaves.resize(leaves.size() - from_leaves);
+		};
+
+		// Takes a loop's or a function's needs and pushes its leaves, unless
+		// that could fail at run time
+		auto apply = [&](const effect_t& effect) {
+			const auto& want = effect.needs;
+			const auto left = available();
+			if (left && *left < want.size())
+				return false;
+			for (size_t depth = 0; depth < want.size(); depth++)
+				if (type_at(depth, want[depth]) != want[depth])
+					return false;
+
+			take(want.size(), [&](size_t depth) { return want[depth]; });
+			leaves.insert(leaves.end(), effect.leaves.begin(), effect.leaves.end());
+			return true;
+		};
+
+		for (size_t pc = 0; pc < body.size() && exact; pc++)
+		{
+			const auto& elem = body[pc];
+
+			if (elem.type() == typeid(number_t) || elem.type() == typeid(variable_ref_t))
+			{
+				leaves.push_back(operand_type::number);
+			}
+			else if (elem.type() == typeid(std::string))
+			{
+				leaves.push_back(operand_type::string);
+			}
+			else if (elem.type() == typeid(function_ref_t))
+			{
+				const auto& name = std::any_cast<function_ref_t const&>(elem).name;
+
+				const verdict_t* callee;
+				const auto func = find_function(name, callee);
+				if (!func)
+				{
+					exact = false;
+					break;
+				}
+
+				const auto opr_count = std::get<0>(*func);
+				if (const auto left = available(); left && *left < opr_count)
+					return WC_ERROR(eval, "Function '{}' requires {} elements but only {} are left",
+									name, opr_count, *left);
+
+				for (size_t depth = 0; depth < opr_count; depth++)
+				{
+					const auto got = type_at(depth, operand_type::number);
+					if (!got)
+						exact = false;
+					else if (*got != operand_type::number)
+						return WC_ERROR(eval, "Expected operand of type number or"
+										"variable at index {} for function '{}'",
+										opr_count - depth - 1, name);
+				}
+
+				exact = exact && callee && callee->verified && apply(callee->effect);
+			}
+			else if (elem.type() == typeid(operations_iter_t))
+			{
+				const auto op = std::any_cast<operations_iter_t>(elem);
+				const auto opr_list = op->operands();
+				if (op->effect == effect_kind::opaque)
+				{
+					exact = false;
+					break;
+				}
+
+				if (const auto left = available(); left && *left < opr_list.size())
+					return WC_ERROR(exec, "Operation '{}' requires {} elements but only {} are left",
+									op->name, opr_list.size(), *left);
+
+				for (size_t depth = 0; depth < opr_list.size(); depth++)
+				{
+					const auto want = opr_list[opr_list.size() - depth - 1];
+					const auto got = type_at(depth, want);
+					if (!got)
+						exact = false;
+					else if (*got != want)
+						return WC_ERROR(exec, "Expected an operand of type {} at index {} for operation '{}'",
+										type_str(want), opr_list.size() - depth - 1, op->name);
+				}
+				if (!exact)
+					break;
+
+				take(opr_list.size(), [&](size_t depth) { return opr_list[opr_list.size() - depth - 1]; });
+				leaves.insert(leaves.end(), op->results().begin(), op->results().end());
+
+				switch (op->effect)
+				{
+				case effect_kind::plain:
+					break;
+				case effect_kind::clear:
+					leaves.clear();
+					floor = true;
+					break;
+				case effect_kind::opaque:
+					exact = false;
+					break;
+				case effect_kind::break_if:
+					// Leaving a times loop at the end of its body is one pass short of running out
+					breaks = breaks || type != frame_type::times || pc + 1 != body.size();
+					exact = type != frame_type::function;
+					break;
+				case effect_kind::call_loop:
+				{
+					// The loop index is the literal compiled right before the operation
+					if (pc == 0 || body[pc - 1].type() != typeid(number_t))
+					{
+						exact = false;
+						break;
+					}
+					const auto index = (unsigned)std::any_cast<number_t>(body[pc - 1]);
+					const auto inner = has_loop(index) ? loop_verdict(index) : nullptr;
+
+					// A ptimes body runs on its own stack when it runs on the pool
+					exact = inner && inner->verified && !inner->effect.breaks && balanced(inner->effect) &&
+						(op->handler != op__use_ptimes || inner->effect.needs.empty()) && apply(inner->effect);
+					break;
+				}
+				}
+			}
+			else
+			{
+				exact = false;
+			}
+		}
+
+		// While and until take their condition after each pass
+		if (exact && (type == frame_type::while_loop || type == frame_type::until_loop))
+		{
+			const auto left = available();
+			if ((left && *left == 0) || type_at(0, operand_type::number) != operand_type::number)
+				exact = false;
+			else
+				take(1, [](size_t) { return operand_type::number; });
+		}
+
+		// A clear reaches below the needs, and a loop must find its needs again after every pass
+		bool stable = !floor;
+		if (type != frame_type::function)
+		{
+			stable = stable && leaves.size() >= needs.size() &&
+				std::equal(needs.begin(), needs.end(), leaves.rbegin());
+		}
+
+		verdict.verified = exact && stable;
+		return verdict;
+	}
+
+	void wtf_calculator::refresh(verdict_t& verdict, const stack_t& body, frame_type type)
+	{
+		const auto now = stamp();
+		if (verdict.epoch == now)
+			return;
+
+		// Marked first, so that a function calling itself finds an unverified callee
+		verdict = {};
+		verdict.epoch = now;
+		if (auto fresh = verify(body, type))
+			verdict = std::move(*fresh);
+	}
+
+	// Workers and sessions only read the verdicts of their library, so it
+	// brings them up to date before handing them out
+	void wtf_calculator::verify_all()
+	{
+		for (auto& [name, func] : functions)
+		{
+			auto& [opr_count, body, verdict, lines] = func;
+			refresh(verdict, body, frame_type::function);
+		}
+
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		for (unsigned index = 0; index < times.size(); index++)
+		{
+			if (times[index])
+				loop_verdict(library_loops + index);
+		}
+	}
+
+	const verdict_t* wtf_calculator::loop_verdict(unsigned index) const
+	{
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		if (index < library_loops)
+			return library->loop_verdict(index);
+
+		const auto& loop = times[index - library_loops];
+		return loop && loop->verdict.epoch == stamp() ? &loop->verdict : nullptr;
+	}
+
+	const verdict_t* wtf_calculator::loop_verdict(unsigned index)
+	{
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		if (index < library_loops)
+			return library->loop_verdict(index);
+
+		if (!times[index - library_loops])
+			return nullptr;
+
+		auto& loop = *times[index - library_loops];
+		refresh(loop.verdict, loop.body, loop.type);
+		return &loop.verdict;
+	}
+
+	result<> wtf_calculator::check_pure(const std::string& name, std::vector<std::string>& visiting,
+										std::vector<std::string>* reads) const
+	{
+		const auto func = find_function(name);
+		if (!func)
+			return WC_ERROR(exec, "it calls '{}', which does not exist", name);
+
+		// Calling itself again adds nothing to what the first call does
+		if (std::find(visiting.begin(), visiting.end(), name) != visiting.end())
+			return {};
+
+		visiting.push_back(name);
+		std::vector<std::unordered_set<std::string>> scopes(1);
+		auto status = check_pure(std::get<1>(*func), scopes, visiting, reads);
+		visiting.pop_back();
+		return status;
+	}
+
+	// Variables are followed through the scopes the body would open, so that
+	// reading or setting one that is not declared in them is taken as global.
+	// Given reads, global variables may be read and are listed there
+	result<> wtf_calculator::check_pure(const stack_t& body, std::vector<std::unordered_set<std::string>>& scopes,
+										std::vector<std::string>& visiting, std::vector<std::string>* reads) const
+	{
+		auto declared = [&](const std::string& name) {
+			return std::any_of(scopes.begin(), scopes.end(), [&](const auto& scope) { return scope.contains(name); });
+		};
+		auto literal = [&](size_t pc) {
+			return pc > 0 && body[pc - 1].type() == typeid(std::string) ?
+				&std::any_cast<std::string const&>(body[pc - 1]) : nullptr;
+		};
+
+		for (size_t pc = 0; pc < body.size(); pc++)
+		{
+			const auto& elem = body[pc];
+			if (elem.type() == typeid(variable_ref_t))
+			{
+				const auto& name = std::any_cast<variable_ref_t const&>(elem).name;
+				if (declared(name))
+					continue;
+				if (!reads)
+					return WC_ERROR(exec, "it reads the global variable '{}'", name);
+				if (std::find(reads->begin(), reads->end(), name) == reads->end())
+					reads->push_back(name);
+			}
+			else if (elem.type() == typeid(function_ref_t))
+			{
+				const auto& callee_name = std::any_cast<function_ref_t const&>(elem).name;
+				if (auto callee = check_pure(callee_name, visiting, reads); !callee)
+					return callee;
+			}
+			else if (elem.type() == typeid(operations_iter_t))
+			{
+				const auto op = std::any_cast<operations_iter_t>(elem);
+				if (std::find(pure_operations.begin(), pure_operations.end(), op->name) == pure_operations.end())
+					return WC_ERROR(exec, "it uses '{}'", op->name);
+
+				if (op->handler == op_var || op->handler == op_set)
+				{
+					const auto name = literal(pc);
+					if (!name)
+						return WC_ERROR(exec, "it names a variable at run time");
+					if (op->handler == op_var)
+						scopes.back().insert(*name);
+					else if (!declared(*name))
+						return WC_ERROR(exec, "it sets the global variable '{}'", *name);
+				}
+				else if (op->effect == effect_kind::call_loop)
+				{
+					if (pc == 0 || body[pc - 1].type() != typeid(number_t))
+						return WC_ERROR(exec, "it runs a loop not known until run time");
+
+					const auto index = (unsigned)std::any_cast<number_t>(body[pc - 1]);
+					if (!has_loop(index))
+						return WC_ERROR(exec, "it runs a loop that no longer exists");
+
+					scopes.emplace_back();
+					auto inner = check_pure(loop_body(index), scopes, visiting, reads);
+					scopes.pop_back();
+					if (!inner)
+						return inner;
+				}
+			}
+		}
+		return {};
+	}
+
+	// Iterations of a ptimes body run in chunks on workers with copies of the
+	// variables, so breaking out ends a chunk only and whatever it sets but
+	// its own locals and the reductions is lost
+	result<> wtf_calculator::check_parallel(const stack_t& body, std::vector<std::unordered_set<std::string>>& scopes,
+											std::vector<std::string>& visiting, bool outermost) const
+	{
+		auto declared = [&](const std::string& name) {
+			return std::any_of(scopes.begin(), scopes.end(), [&](const auto& scope) { return scope.contains(name); });
+		};
+		auto literal = [&](size_t pc) {
+			return pc > 0 && body[pc - 1].type() == typeid(std::string) ?
+				&std::any_cast<std::string const&>(body[pc - 1]) : nullptr;
+		};
+
+		for (size_t pc = 0; pc < body.size(); pc++)
+		{
+			const auto& elem = body[pc];
+			if (elem.type() == typeid(function_ref_t))
+			{
+				const auto& callee = std::any_cast<function_ref_t const&>(elem).name;
+				const auto func = find_function(callee);
+				if (!func || std::find(visiting.begin(), visiting.end(), callee) != visiting.end())
+					continue;
+
+				visiting.push_back(callee);
+				std::vector<std::unordered_set<std::string>> inner(1);
+				auto status = check_parallel(std::get<1>(*func), inner, visiting, false);
+				visiting.pop_back();
+				if (!status)
+					return status;
+			}
+			else if (elem.type() == typeid(operations_iter_t))
+			{
+				const auto op = std::any_cast<operations_iter_t>(elem);
+				if (op->handler == op_break_if && outermost)
+					return WC_ERROR(exec, "it uses 'break-if', which would end only the chunk of iterations");
+				if (op->handler == op_varg)
+					return WC_ERROR(exec, "it declares a global variable with 'varg'");
+
+				if (op->handler == op_var || op->handler == op_set || op->handler == op_del)
+				{
+					const auto name = literal(pc);
+					if (!name)
+						return WC_ERROR(exec, "it names a variable at run time");
+					if (op->handler == op_var)
+						scopes.back().insert(*name);
+					else if (!declared(*name))
+						return WC_ERROR(exec, "it changes '{}', which is neither its own nor a reduction", *name);
+				}
+				else if (op->effect == effect_kind::call_loop && pc > 0 && body[pc - 1].type() == typeid(number_t))
+				{
+					const auto index = (unsigned)std::any_cast<number_t>(body[pc - 1]);
+					if (!has_loop(index))
+						continue;
+
+					scopes.emplace_back();
+					auto inner = check_parallel(loop_body(index), scopes, visiting, false);
+					scopes.pop_back();
+					if (!inner)
+						return inner;
+				}
+			}
+		}
+		return {};
+	}
+
+	bool wtf_calculator::entry_holds(const verdict_t* verdict) const
+	{
+		if (!verdict || !verdict->verified)
+			return false;
+
+		const auto& needs = verdict->effect.needs;
+		if (stack.size() < needs.size())
+			return false;
+
+		for (size_t depth = 0; depth < needs.size(); depth++)
+		{
+			const auto& elem = stack[stack.size() - depth - 1];
+			if (elem.type() != (needs[depth] == operand_type::number ? typeid(number_t) : typeid(std::string)))
+				return false;
+		}
+		return true;
+	}
+}; // namespace wc
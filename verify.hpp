@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace wc
+{
+	enum class operand_type { number, string };
+
+	// Beyond taking its operands and pushing its results, an operation may
+	// empty the stack, run a compiled loop, end a loop early or do anything
+	enum class effect_kind { plain, clear, call_loop, break_if, opaque };
+
+	// What a block of code does to the stack it starts on, worked out without
+	// running it. Elements below those it needs are left alone
+	struct effect_t {
+		// Types taken from the entry stack, top first, and pushed in their place, bottom first
+		std::vector<operand_type> needs, leaves;
+		// Unset past anything with an unknown effect. A break-if of its own sets breaks
+		bool exact = true, breaks = false;
+	};
+
+	// A verified block runs without per-operation checks once its needs hold
+	// on entry. It goes stale when any function it could call is redefined
+	struct verdict_t {
+		effect_t effect;
+		bool verified = false;
+		uint64_t epoch = 0;
+	};
+}; // namespace wc
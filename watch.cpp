@@ -0,0 +1,174 @@
+#include "watch.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <filesystem>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace wc
+{
+	namespace
+	{
+		volatile std::sig_atomic_t watch_stop = 0;
+
+		void on_stop_signal(int)
+		{
+			watch_stop = 1;
+		}
+
+		// Edits arriving this long after the first are taken as the same change
+		constexpr int settle_ms = 50;
+	}
+
+	// Tokens are cut as compile cuts them
+	std::vector<statement_t> split_statements(std::istream& is)
+	{
+		std::vector<statement_t> out;
+		statement_t current;
+		int depth = 0;
+		std::string line, previous;
+
+		for (unsigned number = 1; std::getline(is, line); number++)
+		{
+			if (current.lines.empty())
+				current.line = number;
+			current.lines.push_back(line);
+
+			const std::string_view code = std::string_view(line).substr(0, line.find(';'));
+			auto separator = [](char c) { return std::isspace(static_cast<unsigned char>(c)) || c == '~'; };
+			for (auto it = code.begin(); it != code.end();)
+			{
+				it = std::find_if_not(it, code.end(), separator);
+				const auto end = std::find_if(it, code.end(), separator);
+				if (it == end)
+					break;
+
+				const std::string token(it, end);
+				it = end;
+				current.key += current.key.empty() ? token : " " + token;
+
+				if (token == "defun" || token == "defvar")
+				{
+					depth++;
+					if (previous.size() > 1 && previous[0] == ':')
+						current.defines.push_back((token == "defvar" ? "$" : "") + previous.substr(1));
+				}
+				else if (token == "times" || token == "ptimes" || token == "while" || token == "until")
+				{
+					depth++;
+				}
+				else if (token == "end" || token == "end-times" || token == "end-ptimes" ||
+						 token == "end-while" || token == "end-until")
+				{
+					depth--;
+				}
+				else if (token.size() > 1 && (token[0] == '@' || token[0] == '$'))
+				{
+					// Derived variables are kept by their $name like functions by theirs
+					const auto name = token[0] == '@' ? token.substr(1) : token;
+					if (std::find(current.calls.begin(), current.calls.end(), name) == current.calls.end())
+						current.calls.push_back(name);
+				}
+				previous = token;
+			}
+
+			// A stray end is an error of its own line
+			depth = std::max(depth, 0);
+			if (depth == 0)
+			{
+				out.push_back(std::move(current));
+				current = {};
+			}
+		}
+
+		if (!current.lines.empty())
+			out.push_back(std::move(current));
+		return out;
+	}
+
+	file_watch::file_watch()
+		:fd(inotify_init1(IN_CLOEXEC))
+	{
+	}
+
+	file_watch::~file_watch()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool file_watch::add(const std::string& path)
+	{
+		if (fd < 0)
+			return false;
+		if (files.contains(path))
+			return true;
+
+		const auto directory = std::filesystem::path(path).parent_path().string();
+		const bool known = std::any_of(directories.begin(), directories.end(),
+									   [&](const auto& entry) { return entry.second == directory; });
+		if (!known)
+		{
+			const int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (wd < 0)
+				return false;
+			directories[wd] = directory;
+		}
+
+		files.insert(path);
+		return true;
+	}
+
+	std::vector<std::string> file_watch::wait()
+	{
+		struct sigaction sa {}, old_int, old_term;
+		sa.sa_handler = on_stop_signal;
+		sigemptyset(&sa.sa_mask);
+		watch_stop = 0;
+		sigaction(SIGINT, &sa, &old_int);
+		sigaction(SIGTERM, &sa, &old_term);
+
+		std::vector<std::string> changed;
+		int timeout = -1;
+		while (!watch_stop)
+		{
+			pollfd pfd {fd, POLLIN, 0};
+			const int ready = poll(&pfd, 1, timeout);
+			if (ready < 0 && errno != EINTR)
+				break;
+			if (ready == 0 && !changed.empty())
+				break;
+			if (ready <= 0)
+				continue;
+
+			alignas(inotify_event) char buffer[4096];
+			const auto length = read(fd, buffer, sizeof(buffer));
+			for (const char* at = buffer; length > 0 && at < buffer + length;)
+			{
+				const auto event = reinterpret_cast<const inotify_event*>(at);
+				const auto directory = directories.find(event->wd);
+				if (directory != directories.end() && event->len > 0)
+				{
+					const auto path = (std::filesystem::path(directory->second) / event->name).string();
+					if (files.contains(path) && std::find(changed.begin(), changed.end(), path) == changed.end())
+						changed.push_back(path);
+				}
+				at += sizeof(inotify_event) + event->len;
+			}
+
+			if (!changed.empty())
+				timeout = settle_ms;
+		}
+
+		sigaction(SIGINT, &old_int, nullptr);
+		sigaction(SIGTERM, &old_term, nullptr);
+		if (watch_stop)
+			changed.clear();
+		return changed;
+	}
+}; // namespace wc
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <istream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace wc
+{
+	// Lines of a file that are parsed one after the other with nothing left
+	// open in between, as a definition or a loop may span several
+	struct statement_t {
+		unsigned line = 0;
+		std::vector<std::string> lines;
+		// The instructions without comments and spacing, which tell an edit from a move
+		std::string key;
+		// Functions it defines and calls, with derived variables as $name
+		std::vector<std::string> defines, calls;
+		// Whether it ran to the end the last time
+		bool done = false;
+	};
+
+	struct watched_file_t {
+		// Absolute, and as it was first given
+		std::string path, name;
+		std::vector<statement_t> statements;
+	};
+
+	// Cut where the file has no definition or loop open, by counting what opens and closes them
+	std::vector<statement_t> split_statements(std::istream& is);
+
+	// Files watched through the directories they are in, as editors often
+	// replace a file instead of writing to it
+	class file_watch
+	{
+		int fd = -1;
+		std::unordered_map<int, std::string> directories;
+		std::unordered_set<std::string> files;
+
+	public:
+		file_watch();
+		file_watch(const file_watch&) = delete;
+		~file_watch();
+
+		// Takes an absolute path; false when inotify refuses it
+		bool add(const std::string& path);
+
+		// Blocks until a watched file changed, then waits for the writes that
+		// follow shortly after. Empty once interrupted by SIGINT or SIGTERM
+		std::vector<std::string> wait();
+	};
+}; // namespace wc
@@ -2,22 +2,111 @@
 
 namespace wc
 {
+	namespace
+	{
+		using calc_t = wtf_calculator;
+
+		// A boxed number takes twice its size from malloc, with the chunk's header
+		constexpr uint64_t node = 2 * sizeof(void*), boxed = 2 * sizeof(calc_t::number_t);
+
+		uint64_t code_memory(const calc_t::stack_t& s)
+		{
+			return s.capacity() * sizeof(calc_t::element_t) + s.size() * boxed;
+		}
+
+		size_t element_hash(const calc_t::element_t& elem)
+		{
+			if (elem.type() == typeid(calc_t::number_t))
+				return std::hash<calc_t::number_t>()(std::any_cast<calc_t::number_t>(elem));
+			if (elem.type() == typeid(std::string))
+				return std::hash<std::string>()(std::any_cast<std::string const&>(elem));
+			if (elem.type() == typeid(calc_t::variable_ref_t))
+				return ~std::hash<std::string>()(std::any_cast<calc_t::variable_ref_t const&>(elem).name);
+			if (elem.type() == typeid(calc_t::function_ref_t))
+				return std::hash<std::string>()(std::any_cast<calc_t::function_ref_t const&>(elem).name) * 31;
+			return std::hash<calc_t::operations_iter_t>()(std::any_cast<calc_t::operations_iter_t>(elem));
+		}
+
+		// Numbers compare with their sign, as 0 and -0 divide differently
+		bool same_element(const calc_t::element_t& a, const calc_t::element_t& b)
+		{
+			if (a.type() != b.type())
+				return false;
+			if (a.type() == typeid(calc_t::number_t))
+			{
+				const auto x = std::any_cast<calc_t::number_t>(a), y = std::any_cast<calc_t::number_t>(b);
+				return x == y && std::signbit(x) == std::signbit(y);
+			}
+			if (a.type() == typeid(std::string))
+				return std::any_cast<std::string const&>(a) == std::any_cast<std::string const&>(b);
+			if (a.type() == typeid(calc_t::variable_ref_t))
+				return std::any_cast<calc_t::variable_ref_t const&>(a).name ==
+					std::any_cast<calc_t::variable_ref_t const&>(b).name;
+			if (a.type() == typeid(calc_t::function_ref_t))
+				return std::any_cast<calc_t::function_ref_t const&>(a).name ==
+					std::any_cast<calc_t::function_ref_t const&>(b).name;
+			return std::any_cast<calc_t::operations_iter_t>(a) == std::any_cast<calc_t::operations_iter_t>(b);
+		}
+
+		void unlink(std::unordered_map<std::string, std::vector<std::string>>& dependents, const std::string& name,
+					const std::vector<std::string>& inputs)
+		{
+			for (const auto& input : inputs)
+			{
+				auto& list = dependents[input];
+				std::erase(list, name);
+				if (list.empty())
+					dependents.erase(input);
+			}
+		}
+
+		// Steps between looks at the clock, the memory held and the interrupt flag
+		constexpr uint64_t check_interval = 1 << 16;
+
+		// Loops are entered by their index, compiled as the literal right before the operation
+		template<typename F>
+		void for_each_loop(const calc_t::stack_t& body, F&& f)
+		{
+			for (size_t pc = 1; pc < body.size(); pc++)
+			{
+				if (body[pc].type() != typeid(calc_t::operations_iter_t) ||
+					std::any_cast<calc_t::operations_iter_t>(body[pc])->effect != effect_kind::call_loop ||
+					body[pc - 1].type() != typeid(calc_t::number_t))
+					continue;
+				f(static_cast<unsigned>(std::any_cast<calc_t::number_t>(body[pc - 1])));
+			}
+		}
+	}
+
 	wtf_calculator::wtf_calculator()
 	{
 		tp_begin = std::chrono::high_resolution_clock::now();
 	}
 
-	void wtf_calculator::start(int argc, char** argv)
+	wtf_calculator::wtf_calculator(const wtf_calculator* library)
+		:library(library)
 	{
-		parse_arguments(argc, argv);
+		tp_begin = std::chrono::high_resolution_clock::now();
+
+		variables = library->variables;
+		verbose = library->verbose;
+		suppress_verbose = library->suppress_verbose;
+		update_tracing();
+		rng_seed = library->rng_seed;
+		max_memory = library->max_memory;
+		raw_output = library->raw_output;
+		track_memory = library->track_memory;
+		max_steps = library->max_steps;
+		timeout = library->timeout;
+		for (const auto& [name, memo] : library->memos)
+			memos.emplace(name, memo_table(memo.capacity));
+		derived = library->derived;
+		dependents = library->dependents;
+		stale_derived = library->stale_derived;
 	}
 
 	wtf_calculator::~wtf_calculator()
 	{
-#ifndef WC_USE_TRADITIONAL_GETLINE
-		rl_clear_history();
-#endif
-
 		if (is_time)
 		{
 			auto tp_end = std::chrono::high_resolution_clock::now();
@@ -29,167 +118,68 @@ namespace wc
 			auto diff_mins = std::chrono::duration_cast<std::chrono::minutes>(tp_diff);
 			std::println(stderr, "Runtime (truncated): {}, {}, {}, {}, {}",
 						 diff_nsecs, diff_usecs, diff_msecs, diff_secs, diff_mins);
+
+			// The peak is only watched for under --max-memory, which would skew the times
+			const auto held = memory();
+			memory_peak = std::max(memory_peak, held.total());
+			std::println(stderr, "Memory (approximate): {} bytes held{}; stacks {}, loops {}, "
+						 "functions {}, variables {}, locals {}", held.total(),
+						 track_memory ? std::format(", {} at peak", memory_peak) : std::string(),
+						 held.stacks, held.loops, held.functions, held.variables, held.locals);
 		}
-	}
 
-	void wtf_calculator::show_help(char* name)
-	{
-		std::println(stderr, "{}: Wtf Calculator: Another RPN calculator\n"
-					 "\t-h, --help: Show this\n"
-					 "\t-e, --expr [EXPRESSION]: Calculates EXPRESSION\n"
-					 "\t-f, --file [FILE]: Read expressions from FILE\n"
-					 "\t-s, --stdin: Read expression from standard input until EOF\n"
-					 "\t-r, --repl: Start the REPL\n"
-					 "\t-p, --prefix: Use prefix notation\n"
-					 "\t-t, --time: Show runtime\n"
-					 "\t-v, --verbose: Be verbose", name);
-	}
-
-	void wtf_calculator::parse_arguments(int argc, char** argv)
-	{
-		enum class work_type { expression, file, stdin };
-		struct _parsed_t {
-			std::list<std::pair<work_type, std::string_view>> work;
-			bool is_repl;
-
-			bool *const is_time_ptr, *const is_prefix_ptr, *const is_verbose_ptr;
-			char **argv;
-
-			_parsed_t(wtf_calculator* ins, int argc, char** argv)
-				:is_repl(argc == 1),
-				 is_time_ptr(&ins->is_time), is_prefix_ptr(&ins->is_prefix),
-				 is_verbose_ptr(&ins->verbose), argv(argv)
-			{}
-		} parsed(this, argc, argv);
-
-		const std::array<std::tuple<std::string_view, int, void(*)(_parsed_t&, int)>, 8> arguments {{
-				{"help", 0, [](_parsed_t& p, int i) {
-					wtf_calculator::show_help(p.argv[0]);
-					WC_EXCEPTION(init_help, "");
-				}},
-				{"expr", 1, [](_parsed_t& p, int i) {
-					p.work.push_back({work_type::expression, std::string_view(p.argv[i+1])});
-				}},
-				{"file", 1, [](_parsed_t& p, int i) {
-					p.work.push_back({work_type::file, std::string_view(p.argv[i+1])});
-				}},
-				{"stdin", 0, [](_parsed_t& p, int i) {
-					p.work.push_back({work_type::stdin, ""});
-				}},
-				{"repl", 0, [](_parsed_t& p, int i) {
-					p.is_repl = true;
-				}},
-				{"prefix", 0, [](_parsed_t& p, int i) {
-					WC_STD_EXCEPTION("--prefix is currently broken");
-					*p.is_prefix_ptr = true;
-				}},
-				{"time", 0, [](_parsed_t& p, int i) {
-					*p.is_time_ptr = true;
-				}},
-				{"verbose", 0, [](_parsed_t& p, int i) {
-					*p.is_verbose_ptr = true;
-				}}
-			}
-		};
+		// tic/toc regions are summed up even without --time
+		if (timer && !library && (is_time || timer->has_regions()))
+			timer->report(stderr);
 
-		std::list<std::pair<int, int>> todo;
-		for (int i=1; i < argc; i++)
+		if (timer && !counters_path.empty())
 		{
-			const auto length = (int)std::strlen(argv[i]);
-
-			if (length > 2 && argv[i][0] == '-' && argv[i][1] == '-')
-			{
-				bool none = true;
-				const char* arg = &argv[i][2];
-
-				for (int k=0; k < (int)arguments.size(); k++)
-				{
-					const auto& [name, ops, _func] = arguments[k];
-					if (name == arg)
-					{
-						if (i+ops >= argc)
-							WC_EXCEPTION(init, "Argument '{}' requires {} operands but only {} "
-										 "are left", name, ops, argc-i-1);
-						todo.push_back({k, i});
-						i += ops;
-						none = false;
-						break;
-					}
-				}
-
-				if (none)
-					WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i]);
-			}
-			else if (length > 1 && argv[i][0] == '-')
-			{
-				for (int j=1; j < length; j++)
-				{
-					bool none = true;
-					const char arg = argv[i][j];
-
-					for (int k=0; k < (int)arguments.size(); k++)
-					{
-						const auto& [name, ops, _func] = arguments[k];
-						if (name[0] == arg)
-						{
-							if (ops > 0 && j != length-1)
-								WC_EXCEPTION(init, "Argument '{}' requiring non-zero operands should "
-											 "be at the end", name[0]);
-							if (i+ops >= argc)
-								WC_EXCEPTION(init, "Argument '{}' requires {} operands but only {} "
-											 "are left", name[0], ops, argc-i-1);
-							todo.push_back({k, i});
-							i += ops;
-							none = false;
-						}
-					}
-
-					if (none)
-						WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i][j]);
-				}
-			}
+			std::ofstream ofs(counters_path);
+			if (ofs.is_open())
+				timer->write_json(ofs);
 			else
-			{
-				WC_EXCEPTION(init, "Unknown argument: '{}'", argv[i]);
-			}
+				std::println(stderr, "Cannot write the counters to '{}'", counters_path);
 		}
-		for (auto [k, i] : todo)
+
+		if (sampling)
 		{
-			std::get<2>(arguments[k])(parsed, i);
+			sampling->stop();
+
+			std::ofstream ofs(sample_path);
+			if (ofs.is_open())
+				sampling->write_folded(ofs);
+			else
+				std::println(stderr, "Cannot write the samples to '{}'", sample_path);
 		}
 
-		for (const auto& [type, what] : parsed.work)
+		// Workers and sessions hand their records to the instance they came from
+		if (profile && !library)
 		{
-			switch(type)
-			{
-			case work_type::expression:
-				parse(what);
-				break;
-			case work_type::file:
-				file(what);
-				break;
-			case work_type::stdin:
-				file(std::cin);
-				break;
-			}
+			const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - tp_begin);
+			profile->report(stderr, wall);
+
+			std::ofstream ofs(profile_path);
+			if (ofs.is_open())
+				profile->write_json(ofs, wall);
+			else
+				std::println(stderr, "Cannot write the profile to '{}'", profile_path);
 		}
-		if (parsed.is_repl || parsed.work.empty())
-			repl();
 	}
 
-	void wtf_calculator::execute()
+	result<> wtf_calculator::execute()
 	{
 		while (stack.size() > 0 && stack.back().type() == typeid(operations_iter_t))
 		{
-			auto op = std::any_cast<operations_iter_t&&>(std::move(stack.back()));
+			const auto op = std::any_cast<operations_iter_t>(stack.back());
 			stack.pop_back();
 
-			const auto& [opr_list, op_func] = op->second;
+			const auto opr_list = op->operands();
 
 			if (stack.size() < opr_list.size())
 			{
-				WC_EXCEPTION(exec, "Operation '{}' requires {} elements but only {} are left",
-							 op->first, opr_list.size(), stack.size());
+				return WC_ERROR(exec, "Operation '{}' requires {} elements but only {} are left",
+								op->name, opr_list.size(), stack.size());
 			}
 			else
 			{
@@ -208,79 +198,412 @@ namespace wc
 					{
 						WC_STD_EXCEPTION("Unknown operand type '{}' encountered while"
 										 "executing operation '{}'. This is a program error",
-										 opr.type().name(), op->first);
+										 opr.type().name(), op->name);
 					}
 
 					if (need_opr_type != opr_type)
 					{
-						WC_EXCEPTION(exec, "Expected an operand of type {} at index {} for operation '{}'",
-									 need_opr_type == operand_type::string ? "string" :
-									 (need_opr_type == operand_type::number ? "number" : "unknown"),
-									 opr_index, op->first);
+						return WC_ERROR(exec, "Expected an operand of type {} at index {} for operation '{}'",
+										need_opr_type == operand_type::string ? "string" :
+										(need_opr_type == operand_type::number ? "number" : "unknown"),
+										opr_index, op->name);
 					}
 				}
 
-				op_func(this);
+				if (auto done = profile ? call_profiled(op) : op->handler(this); !done)
+					return done;
 			}
 		}
+
+		return {};
 	}
 
-	void wtf_calculator::ensure_clean_stack()
+	void wtf_calculator::ensure_clean_stack(size_t frames_base)
 	{
-		const auto it_pop_locals = operations.find("_pop_locals"),
-			it_push_locals = operations.find("_push_locals");
-		std::list<std::string> names;
-
-		if (variables_local.size() > 0)
+		while (frames.size() > frames_base)
 		{
-			std::list<stack_t::iterator> it_names;
-			for (auto it = secondary_stack.begin(); it != secondary_stack.end(); it++)
-			{
-				if ((*it).type() == typeid(operations_iter_t))
-				{
-					auto it_op = std::any_cast<operations_iter_t>(*it);
-					if (it_op == it_pop_locals)
-					{
-						it_names.push_back(it-1);
-					}
-					else if (it_op == it_push_locals)
-					{
-						break;
-					}
-				}
-			}
-			for (auto& it_name : it_names)
-				names.push_back(std::any_cast<std::string&&>(std::move(*it_name)));
+			if (frames.back().memo)
+				memo_keys.resize(frames.back().memo_key);
+			pop_frame();
 		}
 
 		secondary_stack.clear();
-		for (auto& name : names)
+		secondary_pc = 0;
+	}
+
+	void wtf_calculator::push_locals(scope_type scope, const std::string& name)
+	{
+		if (tracing) [[unlikely]]
+			trace(trace_named(trace_kind::begin, stack.size(), name, 0, variables_local.size(),
+							  static_cast<uint16_t>(scope)));
+
+		variables_local.push_back({scope, {}});
+	}
+
+	void wtf_calculator::pop_locals(const std::string& name)
+	{
+		if (variables_local.empty())
+		{
+			WC_STD_EXCEPTION("Locals of '{}' popped from an empty list. This is a program error", name);
+		}
+
+		if (tracing) [[unlikely]]
+		{
+			const auto& [scope, locals] = variables_local.back();
+			trace(trace_named(trace_kind::end, stack.size(), name, locals.size(), variables_local.size()-1,
+							  static_cast<uint16_t>(scope)));
+		}
+
+		variables_local.pop_back();
+	}
+
+	void wtf_calculator::push_frame(frame_type type, const stack_t& body, const locations_t* lines,
+									unsigned remaining, std::string name, bool checked)
+	{
+		push_locals(type == frame_type::function ? scope_type::function : scope_type::loop, name);
+
+		uint64_t profiled = 0;
+		if (profile)
+		{
+			profiled = type == frame_type::function ?
+				profile->enter(profile->block("@" + name, profile_kind::function)) :
+				profile->enter(profile->block(name, profile_kind::loop));
+		}
+		frames.push_back({&body, lines, 0, type, remaining, std::move(name), checked, profiled});
+	}
+
+	void wtf_calculator::pop_frame()
+	{
+		if (profile)
+			profile->leave(frames.back().profiled);
+
+		pop_locals(frames.back().name);
+		frames.pop_back();
+	}
+
+	bool wtf_calculator::is_running(const std::string& function) const
+	{
+		const auto it = functions.find(function);
+		return it != functions.end() && std::ranges::any_of(frames, [&](const frame_t& frame) {
+			return frame.body == &std::get<1>(it->second);
+		});
+	}
+
+	void wtf_calculator::take_sample()
+	{
+		const auto active = sampler::active.load();
+		if (!sample_pending.exchange(false) || !active)
+			return;
+
+		auto where = [](const location_t& at) {
+			return at.source ? std::format("{}:{}", *at.source, at.line) : std::string("?");
+		};
+
+		// The line outside of any frame first, then every frame at the instruction it is on
+		std::string folded = where(location);
+		for (const auto& frame : frames)
+		{
+			folded += frame.type == frame_type::function ? ";@" : ";";
+			folded += frame.name;
+			if (frame.lines && frame.pc > 0)
+				folded += " " + where((*frame.lines)[frame.pc - 1]);
+		}
+		active->add(std::move(folded));
+	}
+
+	void wtf_calculator::trace(const trace_record& record)
+	{
+		if (trace_out)
+			trace_out->push(record);
+		if (verbose)
+			std::println(stderr, "{}", trace_text(record));
+	}
+
+	uint64_t wtf_calculator::loop_memory(const loop_t& loop)
+	{
+		return sizeof(loop_t) + code_memory(loop.body) + loop.lines.capacity() * sizeof(location_t);
+	}
+
+	wtf_calculator::memory_t wtf_calculator::memory() const
+	{
+		auto names = [](const std::unordered_map<std::string, number_t>& map) {
+			uint64_t bytes = map.bucket_count() * sizeof(void*);
+			for (const auto& [name, value] : map)
+				bytes += node + sizeof(std::pair<const std::string, number_t>) +
+					(name.capacity() > 15 ? name.capacity() + 1 : 0);
+			return bytes;
+		};
+
+		memory_t out;
+		out.stacks = code_memory(stack) + code_memory(secondary_stack) + frames.capacity() * sizeof(frame_t);
+		for (const auto& frame : frames)
+			out.stacks += frame.name.capacity() > 15 ? frame.name.capacity() + 1 : 0;
+
+		out.loops = times.capacity() * sizeof(times[0]) + loop_hashes.bucket_count() * sizeof(void*) +
+			loop_hashes.size() * (node + sizeof(std::pair<const size_t, unsigned>));
+		for (const auto& loop : times)
 		{
-			secondary_stack.push_back(std::move(name));
-			secondary_stack.push_back(it_pop_locals);
-			evaluate();
+			if (loop)
+				out.loops += loop_memory(*loop);
 		}
+
+		for (const auto& [name, function] : functions)
+		{
+			const auto& [opr_count, body, verdict, lines] = function;
+			out.functions += node + sizeof(std::pair<const std::string, function_t>) + name.capacity() +
+				code_memory(body) + lines.capacity() * sizeof(location_t);
+		}
+
+		out.variables = names(variables);
+		for (const auto& [name, var] : derived)
+			out.variables += node + sizeof(std::pair<const std::string, derived_t>) + code_memory(var.body) +
+				var.lines.capacity() * sizeof(location_t);
+		for (const auto& [scope, locals] : variables_local)
+			out.locals += node + sizeof(std::tuple<scope_type, decltype(variables)>) + names(locals);
+		return out;
+	}
+
+	result<> wtf_calculator::check_memory()
+	{
+		const auto held = memory().total();
+		memory_peak = std::max(memory_peak, held);
+
+		if (max_memory && held > max_memory)
+			return WC_ERROR(limit, "Out of the memory budget: {} bytes held, {} allowed", held, max_memory);
+		return {};
+	}
+
+	result<> wtf_calculator::check_limits()
+	{
+		next_check = std::min(steps + check_interval, step_limit);
+
+		if (interrupt && interrupt->load(std::memory_order_relaxed))
+			return WC_ERROR(limit, "Interrupted");
+		if (steps >= step_limit)
+			return WC_ERROR(limit, "Out of the step budget: {} steps allowed", max_steps);
+		if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline)
+			return WC_ERROR(limit, "Out of the time budget: {} ms allowed",
+							std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+		return track_memory ? check_memory() : result<> {};
+	}
+
+	// Steps are counted exactly, the rest is looked at every 64Ki steps
+	void wtf_calculator::start_budget(uint64_t limit, std::chrono::steady_clock::time_point until)
+	{
+		step_limit = limit;
+		deadline = until;
+		const bool watch = track_memory || interrupt || until != std::chrono::steady_clock::time_point::max();
+		next_check = std::min(watch ? steps + check_interval : UINT64_MAX, step_limit);
+	}
+
+	wtf_calculator::budget_scope::budget_scope(wtf_calculator* ins)
+		:ins(ins), outer(!ins->budgeted)
+	{
+		if (!outer)
+			return;
+		ins->budgeted = true;
+		ins->start_budget(ins->max_steps ? ins->steps + ins->max_steps : UINT64_MAX,
+						  ins->timeout.count() > 0 ? std::chrono::steady_clock::now() + ins->timeout :
+						  std::chrono::steady_clock::time_point::max());
 	}
 
-	void wtf_calculator::evaluate()
+	wtf_calculator::budget_scope::~budget_scope()
 	{
+		if (!outer)
+			return;
+		ins->budgeted = false;
+		ins->start_budget(UINT64_MAX, std::chrono::steady_clock::time_point::max());
+	}
+
+	result<> wtf_calculator::call_profiled(operations_iter_t op)
+	{
+		const auto id = profile->enter(profile->operation(op, op->name));
+		auto done = op->handler(this);
+		profile->leave(id);
+		return done;
+	}
+
+	// Only a call known to take and leave numbers alone can be replaced by its results
+	result<> wtf_calculator::check_memo(const std::string& name, const verdict_t* verdict) const
+	{
+		const auto number = [](operand_type t) { return t == operand_type::number; };
+		if (!verdict || !verdict->verified || verdict->effect.breaks)
+			return WC_ERROR(exec, "Function '{}' has no verified effect on the stack", name);
+		if (!std::all_of(verdict->effect.needs.begin(), verdict->effect.needs.end(), number) ||
+			!std::all_of(verdict->effect.leaves.begin(), verdict->effect.leaves.end(), number))
+			return WC_ERROR(exec, "Function '{}' takes or leaves strings", name);
+
+		std::vector<std::string> visiting;
+		if (auto pure = check_pure(name, visiting); !pure)
+			return WC_ERROR(exec, "Function '{}' is not pure: {}", name, pure.error().message());
+		return {};
+	}
+
+	memo_table* wtf_calculator::find_memo(const std::string& name, const verdict_t* verdict)
+	{
+		const auto it = memos.find(name);
+		if (it == memos.end())
+			return nullptr;
+
+		// Whatever the function calls may have been redefined since
+		auto& memo = it->second;
+		if (memo.epoch != stamp())
+		{
+			memo.epoch = stamp();
+			memo.usable = check_memo(name, verdict).has_value();
+			if (memo.usable)
+				memo.reset(verdict->effect.needs.size(), verdict->effect.leaves.size());
+			else
+				memo.reset(0, 0);
+		}
+		return memo.usable && entry_holds(verdict) ? &memo : nullptr;
+	}
+
+	// The call takes the arguments it needs off the stack and leaves its results
+	// in their place, so a hit replaces the one by the other
+	bool wtf_calculator::recall(memo_table& memo)
+	{
+		const auto base = memo_keys.size();
+		for (size_t i = stack.size() - memo.arity(); i < stack.size(); i++)
+			memo_keys.push_back(std::any_cast<number_t>(stack[i]));
+
+		const auto found = memo.find(&memo_keys[base]);
+		if (!found)
+		{
+			memo.misses++;
+			return false;
+		}
+
+		memo.hits++;
+		memo_keys.resize(base);
+		stack.resize(stack.size() - memo.arity());
+		stack.insert(stack.end(), found, found + memo.result_count());
+		return true;
+	}
+
+	void wtf_calculator::remember(const frame_t& frame)
+	{
+		auto& memo = *frame.memo;
+		const auto count = memo.result_count();
+		const bool numbers = stack.size() >= count && std::all_of(stack.end() - count, stack.end(),
+			[](const element_t& elem) { return elem.type() == typeid(number_t); });
+
+		if (numbers)
+		{
+			for (size_t i = stack.size() - count; i < stack.size(); i++)
+				memo_keys.push_back(std::any_cast<number_t>(stack[i]));
+			memo.store(&memo_keys[frame.memo_key], &memo_keys[frame.memo_key + memo.arity()]);
+		}
+		memo_keys.resize(frame.memo_key);
+	}
+
+	result<> wtf_calculator::end_frame_iteration()
+	{
+		auto& frame = frames.back();
+
+		bool again = false;
+		if (frame.type == frame_type::times)
+		{
+			again = --frame.remaining > 0;
+		}
+		else if (frame.type == frame_type::while_loop || frame.type == frame_type::until_loop)
+		{
+			if (stack.empty() || stack.back().type() != typeid(number_t))
+				return WC_ERROR(exec, "Loop '{}' requires a number condition at the end of its body",
+								frame.name);
+
+			auto condition = std::any_cast<number_t>(stack.back());
+			stack.pop_back();
+
+			again = (frame.type == frame_type::while_loop) == (std::fpclassify(condition) != FP_ZERO);
+		}
+
+		if (again)
+		{
+			pop_locals(frame.name);
+			frame.pc = 0;
+			push_locals(scope_type::loop, frame.name);
+		}
+		else
+		{
+			if (frame.memo) [[unlikely]]
+				remember(frame);
+			pop_frame();
+		}
+
+		return {};
+	}
+
+	result<> wtf_calculator::evaluate(size_t frames_base)
+	{
+		result<> status;
 		try
 		{
-			while (secondary_stack.size() > 0)
+			while (status)
 			{
-				auto elem = std::move(secondary_stack.front());
-				secondary_stack.pop_front();
+				if (sample_pending.load(std::memory_order_relaxed)) [[unlikely]]
+					take_sample();
+				if (++steps >= next_check) [[unlikely]]
+				{
+					status = check_limits();
+					if (!status)
+						break;
+				}
+
+				element_t elem;
+				bool checked = true, from_frame = false;
+				if (frames.size() > frames_base)
+				{
+					auto& frame = frames.back();
+					if (frame.pc == frame.body->size())
+					{
+						status = end_frame_iteration();
+						continue;
+					}
+					const auto& next = (*frame.body)[frame.pc++];
+
+					// Verified code calls its operations straight through the registry
+					if (!frame.checked && next.type() == typeid(operations_iter_t) && current_eval_function.empty())
+					{
+						const auto op = std::any_cast<operations_iter_t>(next);
+						status = profile ? call_profiled(op) : op->handler(this);
+						continue;
+					}
+
+					elem = next;
+					checked = frame.checked;
+					from_frame = true;
+				}
+				else if (secondary_pc < secondary_stack.size())
+				{
+					elem = std::move(secondary_stack[secondary_pc++]);
+				}
+				else
+				{
+					secondary_stack.clear();
+					secondary_pc = 0;
+					break;
+				}
 
-				if (current_eval_function.empty() && current_eval_times.empty())
+				if (current_eval_function.empty())
 				{
 					if (elem.type() == typeid(variable_ref_t))
 					{
 						auto var = std::any_cast<variable_ref_t const&>(elem);
+						if (stale_derived) [[unlikely]]
+						{
+							status = refresh_derived(var.name);
+							if (!status)
+								break;
+						}
 
 						number_t out;
 						if (!dereference_variable(var, out))
-							WC_EXCEPTION(eval, "No such variable '{}' exists in relevant scopes",
-										 var.name);
+						{
+							status = WC_ERROR(eval, "No such variable '{}' exists in relevant scopes",
+											  var.name);
+							break;
+						}
 
 						elem = out;
 					}
@@ -288,46 +611,55 @@ namespace wc
 					{
 						auto func = std::any_cast<function_ref_t const&>(elem);
 
-						const auto it_func = functions.find(func.name);
-						if (it_func == functions.end())
+						const verdict_t* verdict;
+						const auto it_func = find_function(func.name, verdict);
+						if (!it_func)
 						{
-							WC_EXCEPTION(eval, "No such function '{}' exists", func.name);
+							status = WC_ERROR(eval, "No such function '{}' exists", func.name);
+							break;
 						}
-						else
+
+						const auto& [opr_count, func_stack, _verdict, func_lines] = *it_func;
+
+						// Verified code was checked against the function already
+						if (checked && stack.size() < opr_count)
 						{
-							const auto& [opr_count, func_stack] = it_func->second;
+							status = WC_ERROR(eval, "Function '{}' requires {} elements but only {} are left",
+											  func.name, opr_count, stack.size());
+							break;
+						}
 
-							if (stack.size() < opr_count)
-							{
-								WC_EXCEPTION(eval, "Function '{}' requires {} elements but only {} are left",
-											 func.name, opr_count, stack.size());
-							}
-							else
-							{
-								for (size_t i = 0; i < opr_count; i++)
-								{
-									const auto& opr = stack[stack.size() - i - 1];
-									const auto opr_index = opr_count - i - 1;
-
-									if (opr.type() != typeid(number_t) &&
-										opr.type() != typeid(variable_ref_t))
-									{
-										WC_EXCEPTION(eval, "Expected operand of type number or"
-													 "variable at index {} for function '{}'",
-													 opr_index, func.name);
-									}
-								}
-							}
+						for (size_t i = 0; i < opr_count && checked && status; i++)
+						{
+							const auto& opr = stack[stack.size() - i - 1];
+							const auto opr_index = opr_count - i - 1;
 
-							secondary_stack.push_front(operations.find("_pop_locals"));
-							secondary_stack.push_front(func.name);
-							for (auto it = func_stack.rbegin(); it != func_stack.rend(); it++)
+							if (opr.type() != typeid(number_t) &&
+								opr.type() != typeid(variable_ref_t))
 							{
-								secondary_stack.push_front(*it);
+								status = WC_ERROR(eval, "Expected operand of type number or"
+												  "variable at index {} for function '{}'",
+												  opr_index, func.name);
 							}
-							secondary_stack.push_front(operations.find("_push_locals"));
-							secondary_stack.push_front(func.name);
-							secondary_stack.push_front(static_cast<number_t>(scope_type::function));
+						}
+
+						if (!status)
+							continue;
+
+						memo_table* memo = nullptr;
+						if (!memos.empty()) [[unlikely]]
+						{
+							memo = find_memo(func.name, verdict);
+							if (memo && recall(*memo))
+								continue;
+						}
+
+						push_frame(frame_type::function, func_stack, &func_lines, 0, func.name,
+								   !entry_holds(verdict));
+						if (memo)
+						{
+							frames.back().memo = memo;
+							frames.back().memo_key = memo_keys.size() - memo->arity();
 						}
 						continue;
 					}
@@ -338,70 +670,202 @@ namespace wc
 
 				if (is_op)
 				{
-					const auto& name = std::any_cast<operations_iter_t const&>(elem)->first;
-					for (const auto& what : {"defun", "end", "times", "end-times"})
-						if (name == what)
-						{
-							is_only_stack = true;
-							break;
-						}
+					const auto handler = std::any_cast<operations_iter_t>(elem)->handler;
+					is_only_stack = handler == op_defun || handler == op_defvar || handler == op_end;
 				}
 
-				if (!current_eval_times.empty() && !is_only_stack)
-				{
-					auto& times_stack = times[current_eval_times.back()];
-					times_stack.push_back(std::move(elem));
-				}
-				else if (!current_eval_function.empty() && !is_only_stack)
+				if (!current_eval_function.empty() && !is_only_stack)
 				{
-					auto& func_stack = std::get<1>(functions[current_eval_function]);
+					auto& [opr_count, func_stack, verdict, func_lines] = functions[current_eval_function];
 					func_stack.push_back(std::move(elem));
+
+					const auto frame = from_frame ? &frames.back() : nullptr;
+					func_lines.push_back(frame && frame->lines ? (*frame->lines)[frame->pc - 1] : location);
 				}
 				else
 				{
 					stack.push_back(std::move(elem));
-					if (is_op) execute();
+					if (is_op) status = execute();
 				}
 			}
 		}
 		catch(...)
 		{
-			ensure_clean_stack();
+			ensure_clean_stack(frames_base);
 			throw;
 		}
+
+		// A failed evaluation leaves no frames or pending input behind
+		if (!status)
+			ensure_clean_stack(frames_base);
+		return status;
 	}
 
 	bool wtf_calculator::dereference_variable(const wtf_calculator::variable_ref_t& what, number_t& out)
 	{
-		bool found = false;
+		const auto var = find_variable(what.name);
+		if (var)
+			out = *var;
 
-		for (auto it = variables_local.crbegin(); it != variables_local.crend(); it++)
+		return var != nullptr;
+	}
+
+	wtf_calculator::number_t* wtf_calculator::find_variable(const std::string& name)
+	{
+		for (auto it = variables_local.rbegin(); it != variables_local.rend(); it++)
 		{
-			const auto& [scope, locals] = *it;
+			auto& [scope, locals] = *it;
 
-			auto it_local = locals.find(what.name);
+			auto it_local = locals.find(name);
 			if (it_local != locals.end())
-			{
-				found = true;
-				out = it_local->second;
-				break;
-			}
+				return &it_local->second;
 
 			if (scope != scope_type::loop)
 				break;
 		}
 
-		if (!found)
+		auto it_global = variables.find(name);
+		if (it_global != variables.end())
+			return &it_global->second;
+
+		return nullptr;
+	}
+
+	// The expression runs as a function taking nothing and leaving the value
+	result<> wtf_calculator::define_variable(const std::string& name, function_t&& definition)
+	{
+		auto& [opr_count, body, verdict, lines] = definition;
+		auto checked = verify(body, frame_type::function);
+		if (!checked)
+			return std::unexpected(std::move(checked.error()));
+
+		const auto& effect = checked->effect;
+		if (!checked->verified || !effect.needs.empty() || effect.leaves.size() != 1 ||
+			effect.leaves[0] != operand_type::number)
+			return WC_ERROR(exec, "Variable '{}' must be defined by an expression leaving one number", name);
+		if (variables.contains(name) && !derived.contains(name))
+			return WC_ERROR(exec, "Variable '{}' already exists at scope global", name);
+
+		forget_derived(name);
+		auto& var = derived[name];
+		var.body = std::move(body);
+		var.lines = std::move(lines);
+		stale_derived++;
+
+		auto done = link_inputs(name);
+		if (done)
+			done = refresh_derived(name);
+		if (!done)
 		{
-			auto it_global = variables.find(what.name);
-			if (it_global != variables.end())
-			{
-				found = true;
-				out = it_global->second;
-			}
+			forget_derived(name);
+			variables.erase(name);
 		}
 
-		return found;
+		invalidate(name);
+		return done;
+	}
+
+	// Finds the global variables the expression and the functions it calls
+	// read, which must not lead back to the variable itself
+	result<> wtf_calculator::link_inputs(const std::string& name)
+	{
+		auto& var = derived.at(name);
+
+		std::vector<std::string> reads, visiting;
+		std::vector<std::unordered_set<std::string>> scopes(1);
+		if (auto pure = check_pure(var.body, scopes, visiting, &reads); !pure)
+			return WC_ERROR(exec, "Variable '{}' cannot be derived: {}", name, pure.error().message());
+
+		std::vector<std::string> pending = reads;
+		std::unordered_set<std::string> seen;
+		while (!pending.empty())
+		{
+			const auto input = std::move(pending.back());
+			pending.pop_back();
+			if (input == name)
+				return WC_ERROR(exec, "Variable '{}' would depend on itself", name);
+
+			const auto it = derived.find(input);
+			if (seen.insert(input).second && it != derived.end())
+				pending.insert(pending.end(), it->second.inputs.begin(), it->second.inputs.end());
+		}
+
+		unlink(dependents, name, var.inputs);
+		var.inputs = std::move(reads);
+		for (const auto& input : var.inputs)
+			dependents[input].push_back(name);
+		var.epoch = stamp();
+		return {};
+	}
+
+	// Marks what depends on the variable, which is computed again when read
+	void wtf_calculator::invalidate(const std::string& name)
+	{
+		const auto it = dependents.find(name);
+		if (it == dependents.end())
+			return;
+
+		for (const auto& dependent : it->second)
+		{
+			auto& var = derived.at(dependent);
+			if (var.stale)
+				continue;
+
+			var.stale = true;
+			stale_derived++;
+			invalidate(dependent);
+		}
+	}
+
+	result<> wtf_calculator::refresh_derived(const std::string& name)
+	{
+		const auto it = derived.find(name);
+		if (it == derived.end() || !it->second.stale)
+			return {};
+
+		// A function it calls was redefined since, and may read other variables
+		if (it->second.epoch != stamp())
+		{
+			if (auto linked = link_inputs(name); !linked)
+				return linked;
+		}
+		it->second.stale = false;
+		stale_derived--;
+
+		// Runs on its own, with what is left of the line being evaluated set aside
+		auto pending = std::exchange(secondary_stack, {});
+		const auto pending_pc = std::exchange(secondary_pc, 0);
+		const auto depth = stack.size();
+		auto done = run(it->second.body, "$" + name);
+		secondary_stack = std::move(pending);
+		secondary_pc = pending_pc;
+
+		if (done && (stack.size() != depth + 1 || stack.back().type() != typeid(number_t)))
+			done = WC_ERROR(exec, "Variable '{}' must be defined by an expression leaving one number", name);
+		if (!done)
+		{
+			stack.resize(std::min(stack.size(), depth));
+			it->second.stale = true;
+			stale_derived++;
+			return done;
+		}
+
+		variables[name] = std::any_cast<number_t>(stack.back());
+		stack.pop_back();
+		return {};
+	}
+
+	// Leaves the value, and anything derived from it, in place
+	void wtf_calculator::forget_derived(const std::string& name)
+	{
+		const auto it = derived.find(name);
+		if (it == derived.end())
+			return;
+
+		unlink(dependents, name, it->second.inputs);
+		if (it->second.stale)
+			stale_derived--;
+		derived.erase(it);
 	}
 
 	wtf_calculator::number_t wtf_calculator::resolve_variable_if(const element_t& e)
@@ -426,10 +890,42 @@ namespace wc
 		}
 	}
 
-	void wtf_calculator::parse(std::string_view what)
+	result<> wtf_calculator::parse(std::string_view what)
 	{
 		secondary_stack.clear();
+		secondary_pc = 0;
+
+		struct line_guard {
+			timing* timer;
+			~line_guard() { if (timer) timer->end_line(); }
+		} guard {timer.get()};
+		if (timer)
+			timer->begin_line();
+
+		// Loops of the line go when it is done, unless a function took them
+		struct reclaim_guard {
+			wtf_calculator* ins;
+			~reclaim_guard() { if (ins->loops_pending && ins->frames.empty()) ins->reclaim_loops(); }
+		} reclaim {this};
+		budget_scope budget(this);
+
+		auto compiled = compile(what, true);
+		if (!compiled)
+			return std::unexpected(std::move(compiled.error()));
+		if (auto checked = verify(*compiled, frame_type::function, &stack); !checked)
+			return std::unexpected(std::move(checked.error()));
+		secondary_stack = std::move(*compiled);
+
+		if (timer)
+			timer->lap(phase_type::compile);
+		auto done = evaluate(frames.size());
+		if (timer)
+			timer->lap(phase_type::execute);
+		return done;
+	}
 
+	result<wtf_calculator::stack_t> wtf_calculator::compile(std::string_view what, bool transient)
+	{
 		std::list<std::string> subs;
 		{
 			std::string tmp;
@@ -467,32 +963,83 @@ namespace wc
 			std::reverse(subs.begin(), subs.end());
 		}
 
-		for (auto it = subs.begin(); it != subs.end(); it++)
+		if (timer)
+			timer->lap(phase_type::parse);
+
+		const unsigned library_loops = library ? library->loop_count() : 0;
+
+		// Loops meeting functions this line is about to define are verified when they run
+		const bool defines = !current_eval_function.empty() ||
+			std::find(subs.begin(), subs.end(), "defun") != subs.end() ||
+			std::find(subs.begin(), subs.end(), "defvar") != subs.end();
+
+		stack_t compiled;
+		for (const auto& sub : subs)
 		{
-			static std::list<unsigned> parse_times;
-			static unsigned parse_times_index = 0;
-			if (*it == "times")
+			if (sub == "times" || sub == "ptimes" || sub == "while" || sub == "until")
 			{
-				parse_times.push_back(parse_times_index++);
+				auto loop = std::make_unique<loop_t>(loop_t{{}, sub == "while" ? frame_type::while_loop :
+						sub == "until" ? frame_type::until_loop : frame_type::times, {}, {}, 0, transient});
+				loops_pending = loops_pending || transient;
+
+				unsigned slot = (unsigned)times.size();
+				if (free_loops.empty())
+				{
+					times.push_back(std::move(loop));
+				}
+				else
+				{
+					slot = free_loops.back();
+					free_loops.pop_back();
+					times[slot] = std::move(loop);
+				}
+				compile_loops.push_back({library_loops + slot, "end-" + sub, "_use_" + sub});
+				continue;
 			}
-			else if (*it == "end-times")
+			else if (sub == "end-times" || sub == "end-ptimes" || sub == "end-while" || sub == "end-until")
 			{
-				if (parse_times.empty())
-					WC_EXCEPTION(parse, "Unexpected operation 'end-times'");
-				subs.insert(std::next(it), "_use_times");
-				subs.insert(std::next(it), std::to_string(number_t(parse_times.back())));
-				parse_times.pop_back();
+				if (compile_loops.empty() || std::get<1>(compile_loops.back()) != sub)
+				{
+					compile_loops.clear();
+					return WC_ERROR(parse, "Unexpected operation '{}'", sub);
+				}
+
+				auto [index, end_name, use_name] = std::move(compile_loops.back());
+				compile_loops.pop_back();
+
+				auto& loop = *times[index - library_loops];
+				auto checked = verify(loop.body, loop.type);
+				if (checked)
+				{
+					loop.verdict = std::move(*checked);
+				}
+				else if (!defines)
+				{
+					compile_loops.clear();
+					return std::unexpected(std::move(checked.error()));
+				}
+				index = share_loop(index, library_loops);
+
+				if (compile_loops.empty())
+				{
+					compiled.push_back(static_cast<number_t>(index));
+					compiled.push_back(find_operation(use_name));
+				}
+				else
+				{
+					auto& outer = *times[std::get<0>(compile_loops.back()) - library_loops];
+					outer.body.push_back(static_cast<number_t>(index));
+					outer.body.push_back(find_operation(use_name));
+					outer.lines.insert(outer.lines.end(), 2, location);
+				}
+				continue;
 			}
-		}
 
-		for (const auto& sub : subs)
-		{
 			element_t elem;
 
-			const auto it_op = operations.find(sub);
-			if (it_op != operations.end())
+			if (const auto op = find_operation(sub))
 			{
-				elem = it_op;
+				elem = op;
 			}
 
 			if (!elem.has_value())
@@ -501,7 +1048,8 @@ namespace wc
 				{
 					if (sub.size() <= 1)
 					{
-						WC_EXCEPTION(parse, "Empty string provided");
+						compile_loops.clear();
+						return WC_ERROR(parse, "Empty string provided");
 					}
 					else
 					{
@@ -512,7 +1060,8 @@ namespace wc
 				{
 					if (sub.size() <= 1)
 					{
-						WC_EXCEPTION(parse, "Empty variable provided");
+						compile_loops.clear();
+						return WC_ERROR(parse, "Empty variable provided");
 					}
 					else
 					{
@@ -523,7 +1072,8 @@ namespace wc
 				{
 					if (sub.size() <= 1)
 					{
-						WC_EXCEPTION(parse, "Empty function provided");
+						compile_loops.clear();
+						return WC_ERROR(parse, "Empty function provided");
 					}
 					else
 					{
@@ -533,126 +1083,527 @@ namespace wc
 
 				if (!elem.has_value())
 				{
-					try
-					{
-						elem = std::stold(sub);
-					}
-					catch (const std::out_of_range&) {}
-					catch (const std::invalid_argument&) {}
+					// Same as std::stold, minus its exceptions on garbage
+					char* end;
+					errno = 0;
+					const number_t num = std::strtold(sub.c_str(), &end);
+					if (end != sub.c_str() && errno != ERANGE)
+						elem = num;
 				}
 			}
 
 			if (elem.has_value())
 			{
-				secondary_stack.push_back(std::move(elem));
+				if (compile_loops.empty())
+				{
+					compiled.push_back(std::move(elem));
+				}
+				else
+				{
+					auto& loop = *times[std::get<0>(compile_loops.back()) - library_loops];
+					loop.body.push_back(std::move(elem));
+					loop.lines.push_back(location);
+				}
 			}
 			else
 			{
-				WC_EXCEPTION(parse, "Garbage sub-expression: '{}'", sub);
+				compile_loops.clear();
+				return WC_ERROR(parse, "Garbage sub-expression: '{}'", sub);
 			}
 		}
 
-		evaluate();
+		return compiled;
 	}
 
-	void wtf_calculator::file(std::string_view what)
+	result<> wtf_calculator::run(const stack_t& program, const std::string& name, verdict_t* verdict)
 	{
-		std::ifstream ifs(what.data());
-		if (ifs.is_open())
+		if (verdict)
+			refresh(*verdict, program, frame_type::function);
+
+		budget_scope budget(this);
+		const auto frames_base = frames.size();
+		push_frame(frame_type::function, program, nullptr, 0, name, !entry_holds(verdict));
+		return evaluate(frames_base);
+	}
+
+	thread_pool& wtf_calculator::prepare_workers()
+	{
+		verify_all();
+
+		if (!pool)
 		{
-			file(ifs);
+			pool = std::make_unique<thread_pool>(jobs > 0 ? jobs : std::thread::hardware_concurrency());
+			for (unsigned i = 0; i < pool->size(); i++)
+			{
+				pool_workers.emplace_back(new wtf_calculator(this));
+				// A ring per thread, next to the main one
+				if (!trace_path.empty())
+					pool_workers.back()->trace_out = std::make_shared<trace_ring>(std::format("{}.{}", trace_path, i + 1));
+			}
 		}
-		else
+
+		// Workers take the variables as they are, so derived ones are brought up to
+		// date first; one that fails to compute keeps its last value
+		for (const auto& [name, var] : derived)
 		{
-			WC_EXCEPTION(file, "Cannot open file '{}'", what);
+			if (stale_derived && var.stale)
+				(void)refresh_derived(name);
 		}
-	}
 
-	void wtf_calculator::file(std::istream& is)
-	{
-		std::string line;
-		while (std::getline(is, line))
+		for (auto& worker : pool_workers)
 		{
-			parse(line);
+			worker->stack.clear();
+			worker->frames.clear();
+			worker->variables_local.clear();
+			worker->variables = variables;
+			worker->derived = derived;
+			worker->dependents = dependents;
+			worker->stale_derived = stale_derived;
+			worker->verbose = verbose;
+			worker->suppress_verbose = suppress_verbose;
+			worker->update_tracing();
+			worker->rng_seed = rng_seed;
+			worker->max_steps = max_steps;
+			worker->timeout = timeout;
+			worker->interrupt = interrupt;
+			// Memos declared since the pool started; a worker keeps what it cached in the others
+			std::erase_if(worker->memos, [&](const auto& entry) { return !memos.contains(entry.first); });
+			for (const auto& [name, memo] : memos)
+			{
+				const auto it = worker->memos.find(name);
+				if (it == worker->memos.end() || it->second.capacity != memo.capacity)
+					worker->memos.insert_or_assign(name, memo_table(memo.capacity));
+			}
+			if (profile && !worker->profile)
+				worker->profile = std::make_unique<profiler>();
+			if (timer && !worker->timer)
+				worker->timer = std::make_unique<timing>();
 		}
+
+		return *pool;
 	}
 
-	void wtf_calculator::repl()
+	result<> wtf_calculator::parallel_times(unsigned index, unsigned loops, const std::string& reductions)
 	{
-		auto cleanup_local = [](char*& what) {
-			if (what)
+		enum class reduction_type { sum, product, min, max };
+		static constexpr std::array<std::string_view, 4> reduction_type_str {"sum", "product", "min", "max"};
+
+		std::vector<std::tuple<std::string, reduction_type>> reduce;
+		if (reductions != "none")
+		{
+			std::string_view rest = reductions;
+			while (!rest.empty())
 			{
-				free(what);
-				what = nullptr;
+				const auto item = rest.substr(0, rest.find(','));
+				rest.remove_prefix(std::min(rest.size(), item.size() + 1));
+
+				const auto colon = item.rfind(':');
+				const auto it_type = colon == std::string_view::npos ? reduction_type_str.end() :
+					std::find(reduction_type_str.begin(), reduction_type_str.end(), item.substr(colon + 1));
+				if (it_type == reduction_type_str.end())
+					return WC_ERROR(exec, "Reduction '{}' should look like name:sum, name:product, "
+									"name:min or name:max", item);
+
+				std::string name(item.substr(0, colon));
+				if (!find_variable(name))
+					return WC_ERROR(exec, "No such variable '{}' exists in relevant scopes", name);
+
+				reduce.push_back({std::move(name),
+						static_cast<reduction_type>(it_type - reduction_type_str.begin())});
 			}
-		};
+		}
+
+		const std::string name = "ptimes:" + std::to_string(index);
+		const auto& body = loop_body(index);
 
-		using_history();
+		std::vector<std::unordered_set<std::string>> scopes(1);
+		std::vector<std::string> visiting;
+		for (const auto& [var, type] : reduce)
+			scopes.back().insert(var);
+		if (auto parallel = check_parallel(body, scopes, visiting, true); !parallel)
+			return WC_ERROR(exec, "Loop '{}' cannot run in parallel: {}", name, parallel.error().message());
 
-		bool quit = false;
-		while (!quit)
+		if (library)
 		{
-			try
-			{
-#ifdef WC_USE_TRADITIONAL_GETLINE
-				std::string what_alt;
+			if (loops > 0)
+				push_frame(frame_type::times, body, &loop_lines(index), loops, name,
+						   !entry_holds(loop_verdict(index)));
+			return {};
+		}
+		if (loops == 0)
+			return {};
 
-				std::print("{}>> ", stack.size());
-				if (!std::getline(std::cin, what_alt))
-					WC_EXCEPTION(repl_quit, "");
+		decltype(variables) visible;
+		for (auto it = variables_local.crbegin(); it != variables_local.crend(); it++)
+		{
+			const auto& [scope, locals] = *it;
+			visible.insert(locals.begin(), locals.end());
 
-				if (what_alt.size() > 0)
-				{
-					parse(what_alt);
-				}
-#else
-				char* what = nullptr;
-				try
-				{
-					auto prompt = std::format("{}>> ", stack.size());
+			if (scope != scope_type::loop)
+				break;
+		}
 
-					what = readline(prompt.c_str());
-					if (!what)
-						WC_EXCEPTION(repl_quit, "");
+		auto& pool = prepare_workers();
+		for (auto& worker : pool_workers)
+			worker->variables_local.push_back({scope_type::function, visible});
+
+		// Chunking does not depend on the thread count, so neither do the results
+		const size_t chunk = (loops + 255) / 256, chunks = (loops + chunk - 1) / chunk;
+		std::vector<std::vector<number_t>> partials(chunks);
+		std::vector<std::string> outputs(chunks);
+		std::vector<std::optional<error>> errors(chunks);
+		const uint64_t stream_base = split_stream(rng_stream, ++rng_forks);
+
+		pool.parallel_for(loops, chunk, [&](unsigned worker, size_t begin, size_t end) {
+			auto& ins = *pool_workers[worker];
+			const size_t c = begin / chunk;
+
+			ins.rng_stream = stream_base + c;
+			ins.rng.reseed(ins.rng_seed, ins.rng_stream);
+			// The loop shares the time left to the line; steps count on the thread running the line
+			ins.start_budget(UINT64_MAX, deadline);
+			ins.capture = &outputs[c];
+
+			ins.push_locals(scope_type::loop, name);
+			auto& privates = std::get<1>(ins.variables_local.back());
+			for (const auto& [var, type] : reduce)
+			{
+				privates[var] = type == reduction_type::sum ? 0 : type == reduction_type::product ? 1 :
+					type == reduction_type::min ? INFINITY : -INFINITY;
+			}
 
-					if (*what)
-					{
-						add_history(what);
-						parse(what);
-					}
-				}
-				catch (...)
+			// Chunks left once the time is up or Ctrl-C was pressed are skipped
+			result<> done = ins.check_limits();
+			try
+			{
+				const auto frames_base = ins.frames.size();
+				if (done)
 				{
-					cleanup_local(what);
-					throw;
+					ins.push_frame(frame_type::times, body, &loop_lines(index), (unsigned)(end - begin), name,
+								   !ins.entry_holds(ins.loop_verdict(index)));
+					done = ins.evaluate(frames_base);
 				}
-				cleanup_local(what);
-#endif
+			}
+			catch (...)
+			{
+				ins.capture = nullptr;
+				ins.pop_locals(name);
+				throw;
+			}
 
-				if (stack.size() > 0)
-				{
-					std::print("^");
-					op_top(this);
-				}
+			if (done)
+			{
+				for (const auto& [var, type] : reduce)
+					partials[c].push_back(privates[var]);
 			}
-			catch (const wc::exception& e)
+			else
+			{
+				errors[c] = std::move(done.error());
+			}
+
+			ins.capture = nullptr;
+			ins.pop_locals(name);
+			ins.stack.clear();
+		});
+
+		for (auto& worker : pool_workers)
+		{
+			worker->variables_local.pop_back();
+			if (profile)
+				profile->merge(*worker->profile);
+			if (timer)
+				timer->merge(*worker->timer);
+		}
+
+		// The first chunk to fail is reported, whichever thread got there first
+		for (auto& e : errors)
+			if (e)
+				return std::unexpected(std::move(*e));
+
+		for (size_t r = 0; r < reduce.size(); r++)
+		{
+			const auto& [var, type] = reduce[r];
+			auto& value = *find_variable(var);
+
+			for (const auto& partial : partials)
 			{
-				switch (e.type)
+				switch (type)
 				{
-				case wc::error_type::parse:
-				case wc::error_type::eval:
-				case wc::error_type::exec:
-				case wc::error_type::file:
-					break;
-				case wc::error_type::repl_quit:
-					quit = true;
-					continue;
-				default:
-					throw;
+				case reduction_type::sum: value += partial[r]; break;
+				case reduction_type::product: value *= partial[r]; break;
+				case reduction_type::min: value = std::fmin(value, partial[r]); break;
+				case reduction_type::max: value = std::fmax(value, partial[r]); break;
 				}
-				std::println(stderr, "Error: {}: {}", wc::error_type_str[static_cast<int>(e.type)], e.what());
 			}
+			invalidate(var);
+		}
+
+		for (const auto& output : outputs)
+			print_out("{}", output);
+
+		return {};
+	}
+
+	const wtf_calculator::function_t* wtf_calculator::find_function(const std::string& name) const
+	{
+		const auto it = functions.find(name);
+		if (it != functions.end())
+			return &it->second;
+
+		return library ? library->find_function(name) : nullptr;
+	}
+
+	// Brings the verdict of a function this instance defined up to date
+	const wtf_calculator::function_t* wtf_calculator::find_function(const std::string& name,
+																	 const verdict_t*& verdict)
+	{
+		const auto it = functions.find(name);
+		if (it == functions.end())
+		{
+			const auto func = library ? library->find_function(name) : nullptr;
+			verdict = func && std::get<2>(*func).epoch == library->stamp() ? &std::get<2>(*func) : nullptr;
+			return func;
+		}
+
+		auto& [opr_count, body, own, lines] = it->second;
+		refresh(own, body, frame_type::function);
+		verdict = &own;
+		return &it->second;
+	}
+
+	unsigned wtf_calculator::share_loop(unsigned index, unsigned library_loops)
+	{
+		const unsigned slot = index - library_loops;
+		auto& loop = *times[slot];
+		loop.hash = static_cast<size_t>(loop.type);
+		for (const auto& elem : loop.body)
+			loop.hash = (loop.hash * 1099511628211u) ^ element_hash(elem);
+
+		const auto [first, last] = loop_hashes.equal_range(loop.hash);
+		for (auto it = first; it != last; it++)
+		{
+			const auto& other = *times[it->second];
+			if (other.type != loop.type ||
+				!std::equal(other.body.begin(), other.body.end(), loop.body.begin(), loop.body.end(), same_element))
+				continue;
+
+			// The shared body keeps the lines it was first compiled from
+			if (!loop.transient)
+				keep_loop(library_loops + it->second, library_loops);
+			times[slot].reset();
+			free_loops.push_back(slot);
+			loops_shared++;
+			return library_loops + it->second;
+		}
+
+		loop_hashes.emplace(loop.hash, slot);
+		return index;
+	}
+
+	void wtf_calculator::keep_loop(unsigned index, unsigned library_loops)
+	{
+		if (index < library_loops)
+			return;
+
+		auto& loop = times[index - library_loops];
+		if (!loop || !loop->transient)
+			return;
+
+		loop->transient = false;
+		for_each_loop(loop->body, [&](unsigned inner) { keep_loop(inner, library_loops); });
+	}
+
+	void wtf_calculator::reclaim_loops()
+	{
+		loops_pending = false;
+		const unsigned library_loops = library ? library->loop_count() : 0;
+
+		// Whatever functions, derived variables, loops still being compiled and lasting code reach is kept
+		std::vector<bool> live(times.size());
+		std::vector<unsigned> pending;
+		auto reach = [&](unsigned index) {
+			if (index < library_loops || index - library_loops >= times.size() || live[index - library_loops])
+				return;
+			live[index - library_loops] = true;
+			pending.push_back(index - library_loops);
+		};
+
+		for (const auto& [name, func] : functions)
+			for_each_loop(std::get<1>(func), reach);
+		for (const auto& [name, var] : derived)
+			for_each_loop(var.body, reach);
+		for (const auto& open : compile_loops)
+			reach(std::get<0>(open));
+		for (unsigned slot = 0; slot < times.size(); slot++)
+		{
+			if (times[slot] && !times[slot]->transient)
+				reach(library_loops + slot);
+		}
+
+		while (!pending.empty())
+		{
+			const auto slot = pending.back();
+			pending.pop_back();
+			if (times[slot])
+				for_each_loop(times[slot]->body, reach);
+		}
+
+		for (unsigned slot = 0; slot < times.size(); slot++)
+		{
+			if (!times[slot] || live[slot])
+				continue;
+
+			const auto [first, last] = loop_hashes.equal_range(times[slot]->hash);
+			const auto it = std::find_if(first, last, [&](const auto& entry) { return entry.second == slot; });
+			if (it != last)
+				loop_hashes.erase(it);
+
+			loop_bytes_reclaimed += loop_memory(*times[slot]);
+			loops_reclaimed++;
+			times[slot].reset();
+			free_loops.push_back(slot);
+		}
+	}
+
+	unsigned wtf_calculator::loop_count() const
+	{
+		return (library ? library->loop_count() : 0) + (unsigned)times.size();
+	}
+
+	bool wtf_calculator::has_loop(unsigned index) const
+	{
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		if (index < library_loops)
+			return library->has_loop(index);
+		return index < loop_count() && times[index - library_loops];
+	}
+
+	const wtf_calculator::stack_t& wtf_calculator::loop_body(unsigned index) const
+	{
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		return index < library_loops ? library->loop_body(index) : times[index - library_loops]->body;
+	}
+
+	const locations_t& wtf_calculator::loop_lines(unsigned index) const
+	{
+		const unsigned library_loops = library ? library->loop_count() : 0;
+		return index < library_loops ? library->loop_lines(index) : times[index - library_loops]->lines;
+	}
+
+	result<> wtf_calculator::file(std::string_view what)
+	{
+		if (watcher)
+			return watch_file(what);
+
+		std::ifstream ifs(what.data());
+		if (ifs.is_open())
+		{
+			return file(ifs, what);
+		}
+		else
+		{
+			return WC_ERROR(file, "Cannot open file '{}'", what);
+		}
+	}
+
+	result<> wtf_calculator::file(std::istream& is, std::string_view source)
+	{
+		// A file read by a line of another one returns to that line
+		const auto outer = location;
+		const auto name = intern_source(source);
+
+		result<> done;
+		std::string line;
+		for (unsigned number = 1; done && std::getline(is, line); number++)
+		{
+			location = {name, number};
+			done = parse(line);
+		}
+
+		location = outer;
+		return done;
+	}
+
+	// Runs the file statement by statement, which are kept to compare the file
+	// with once it changed
+	result<> wtf_calculator::watch_file(std::string_view what)
+	{
+		std::ifstream ifs(what.data());
+		if (!ifs.is_open())
+			return WC_ERROR(file, "Cannot open file '{}'", what);
+
+		const auto path = std::filesystem::absolute(what).lexically_normal().string();
+		if (!watcher->add(path))
+			return WC_ERROR(file, "Cannot watch file '{}': {}", what, std::strerror(errno));
+
+		const auto it = std::find_if(watched.begin(), watched.end(), [&](const auto& w) { return w.path == path; });
+		const size_t index = it - watched.begin();
+		if (it == watched.end())
+			watched.push_back({path, std::string(what), {}});
+		watched[index].statements = split_statements(ifs);
+
+		// The file may read itself again, and others join the list as statements run
+		const auto source = intern_source(watched[index].name);
+		result<> done;
+		for (size_t i = 0; done && i < watched[index].statements.size(); i++)
+		{
+			const auto statement = watched[index].statements[i];
+			done = run_statement(statement, source);
+			if (i < watched[index].statements.size())
+				watched[index].statements[i].done = done.has_value();
+		}
+		return done;
+	}
+
+	result<> wtf_calculator::run_statement(const statement_t& statement, const std::string* source)
+	{
+		const auto outer = location;
+
+		result<> done;
+		for (size_t i = 0; done && i < statement.lines.size(); i++)
+		{
+			location = {source, statement.line + static_cast<unsigned>(i)};
+			done = parse(statement.lines[i]);
+		}
+
+		location = outer;
+		return done;
+	}
+
+	// The functions named and every function they may call in turn
+	std::unordered_set<std::string> wtf_calculator::callees(const std::vector<std::string>& names) const
+	{
+		std::unordered_set<std::string> out;
+		std::vector<std::string> pending = names;
+		std::vector<unsigned> loops;
+
+		auto scan = [&](const stack_t& body) {
+			for (const auto& elem : body)
+			{
+				if (elem.type() == typeid(function_ref_t))
+					pending.push_back(std::any_cast<function_ref_t const&>(elem).name);
+			}
+			for_each_loop(body, [&](unsigned index) { loops.push_back(index); });
+		};
+
+		while (!pending.empty() || !loops.empty())
+		{
+			if (!loops.empty())
+			{
+				const auto index = loops.back();
+				loops.pop_back();
+				if (has_loop(index))
+					scan(loop_body(index));
+				continue;
+			}
+
+			auto name = std::move(pending.back());
+			pending.pop_back();
+			if (const auto func = find_function(name); func && !out.contains(name))
+				scan(std::get<1>(*func));
+			out.insert(std::move(name));
 		}
+		return out;
 	}
 
 	void wtf_calculator::display_stack(const stack_t& what_stack)
@@ -662,31 +1613,30 @@ namespace wc
 			if (elem.type() == typeid(variable_ref_t))
 			{
 				auto var = std::any_cast<variable_ref_t const&>(elem);
-				std::print("${}", var.name);
+				print_out("${}", var.name);
 			}
 			else if (elem.type() == typeid(function_ref_t))
 			{
 				auto func = std::any_cast<function_ref_t const&>(elem);
-				std::print("@{}", func.name);
+				print_out("@{}", func.name);
 			}
 			else if (elem.type() == typeid(std::string))
 			{
 				auto str = std::any_cast<std::string const&>(elem);
-				std::print(":{}", str);
+				print_out(":{}", str);
 			}
 			else if (elem.type() == typeid(operations_iter_t))
 			{
-				auto op_it = std::any_cast<operations_iter_t>(elem);
-				std::print("{}", op_it->first);
+				print_out("{}", std::any_cast<operations_iter_t>(elem)->name);
 			}
 			else
 			{
 				auto num = std::any_cast<number_t const&>(elem);
-				std::print("{}", num);
+				print_out("{}", num);
 			}
-			std::print(" ");
+			print_out(" ");
 		}
 		if (!what_stack.empty())
-			std::println("");
+			println_out("");
 	}
 }; // namespace wc
@@ -14,35 +14,89 @@
 #include <any>
 #include <tuple>
 #include <unordered_map>
-#include <deque>
+#include <unordered_set>
 #include <iomanip>
 #include <chrono>
 #include <algorithm>
 #include <print>
 #include <iostream>
-
-#include <readline/readline.h>
-#include <readline/history.h>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <cerrno>
+#include <span>
+#include <initializer_list>
 
 #include "utility.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
+#include "spsc_ring.hpp"
+#include "verify.hpp"
+#include "profile.hpp"
+#include "source.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+#include "memo.hpp"
+#include "watch.hpp"
+#include "output.hpp"
 
 namespace wc
 {
 	class wtf_calculator
 	{
 	public:
-		enum class operand_type { number, string };
+		using operand_type = wc::operand_type;
 		enum class scope_type { function, loop };
+		enum class frame_type { function, times, while_loop, until_loop };
 
 		using number_t = long double;
 		using element_t = std::any;
 
-		template<typename T> using stack_base_t = std::deque<T>;
+		template<typename T> using stack_base_t = std::vector<T>;
 		using stack_t = stack_base_t<element_t>;
 
-		using function_t = std::tuple<unsigned, stack_t>;
-		using operation_t = std::tuple<std::vector<operand_type>, void(*)(wtf_calculator*)>;
-		using operations_iter_t = std::unordered_map<std::string, operation_t>::const_iterator;
+		using function_t = std::tuple<unsigned, stack_t, verdict_t, locations_t>;
+
+		// An entry of the operation registry. Compiled code holds a pointer to
+		// the entry, so running an operation is one call through its handler
+		struct operation_t {
+			using handler_t = result<>(*)(wtf_calculator*);
+
+			std::string_view name;
+			std::array<operand_type, 3> operand_types {};
+			unsigned char arity = 0;
+			handler_t handler = nullptr;
+
+			// What the verifier takes the operation to push and to do otherwise
+			std::array<operand_type, 2> result_types {};
+			unsigned char result_count = 0;
+			effect_kind effect = effect_kind::plain;
+
+			constexpr operation_t(std::string_view name, std::initializer_list<operand_type> operands,
+								  handler_t handler, std::initializer_list<operand_type> results = {},
+								  effect_kind effect = effect_kind::plain)
+				:name(name), arity(static_cast<unsigned char>(operands.size())), handler(handler),
+				 result_count(static_cast<unsigned char>(results.size())), effect(effect)
+			{
+				std::copy(operands.begin(), operands.end(), operand_types.begin());
+				std::copy(results.begin(), results.end(), result_types.begin());
+			}
+
+			// Bottom first
+			constexpr std::span<const operand_type> operands() const { return {operand_types.data(), arity}; }
+			constexpr std::span<const operand_type> results() const { return {result_types.data(), result_count}; }
+		};
+		using operations_iter_t = const operation_t*;
+
+		// Bytes held by the interpreter's own structures, approximately: every
+		// element is taken to box a number and a hash node to cost two pointers
+		struct memory_t {
+			uint64_t stacks = 0, loops = 0, functions = 0, variables = 0, locals = 0;
+			uint64_t total() const { return stacks + loops + functions + variables + locals; }
+		};
 
 		struct variable_ref_t {
 			std::string name;
@@ -58,58 +112,36 @@ namespace wc
 		};
 
 	private:
-		const std::unordered_map<std::string, operation_t> operations {{
-				{"+", {{operand_type::number, operand_type::number}, op_add}},
-				{"-", {{operand_type::number, operand_type::number}, op_subtract}},
-				{"*", {{operand_type::number, operand_type::number}, op_multiply}},
-				{"/", {{operand_type::number, operand_type::number}, op_divide}},
-				{"^", {{operand_type::number, operand_type::number}, op_power}},
-
-				{"replace", {{operand_type::number, operand_type::number}, op_replace}},
-				{"swap", {{operand_type::number, operand_type::number}, op_swap}},
-				{"pop", {{operand_type::number}, op_pop}},
-				{"top", {{operand_type::number}, op_top}},
-				{"topb", {{operand_type::number}, op_topb}},
-
-				{"neg", {{operand_type::number}, op_neg}},
-				{"sin", {{operand_type::number}, op_sin}}, {"cos", {{operand_type::number}, op_cos}},
-				{"floor", {{operand_type::number}, op_floor}}, {"ceil", {{operand_type::number}, op_ceil}},
-
-				{"help", {{}, op_help}}, {"stack", {{}, op_stack}}, {"quit", {{}, op_quit}},
-				{"clear", {{}, op_clear}}, {"file", {{operand_type::string}, op_file}},
-				{"_view", {{}, op__view}},
-
-				{"var", {{operand_type::number, operand_type::string}, op_var}},
-				{"set", {{operand_type::number, operand_type::string}, op_set}},
-				{"varg", {{operand_type::number, operand_type::string}, op_varg}},
-				{"vars", {{}, op_vars}},
-				{"del", {{operand_type::string}, op_del}},
-				{"delall", {{}, op_delall}},
-
-				{"defun", {{operand_type::number, operand_type::string}, op_defun}},
-				{"end", {{}, op_end}},
-				{"desc", {{operand_type::string}, op_desc}},
-				{"funcs", {{}, op_funcs}},
-				{"_push_locals", {{operand_type::number, operand_type::string}, op__push_locals}},
-				{"_pop_locals", {{operand_type::string}, op__pop_locals}},
-
-				{"times", {{}, op_times}},
-				{"desc-loop", {{operand_type::number}, op_desc_loop}},
-				{"loops", {{}, op_loops}},
-				{"end-times", {{}, op_end_times}},
-				{"_use_times", {{operand_type::number, operand_type::number}, op__use_times}},
-
-				{"noverbose", {{}, op_noverbose}},
-				{"verbose", {{}, op_verbose}},
-
-				{"print", {{operand_type::string}, op_print}},
-				{"println", {{operand_type::string}, op_println}}
-			}
+		// Defined along with the operations, where it is indexed at compile time
+		static const operation_t operations[];
+
+		struct loop_t {
+			stack_t body;
+			frame_type type;
+			verdict_t verdict;
+			locations_t lines;
+			size_t hash = 0;
+			// Compiled by parse, so freed once no function refers to it
+			bool transient = false;
 		};
 
 		stack_t stack, secondary_stack;
-		std::deque<stack_t> times;
+		size_t secondary_pc = 0;
+		// Frames point into loop bodies, which stay in place as more are compiled.
+		// A freed body leaves its slot empty for the next one, as code holds indices
+		std::vector<std::unique_ptr<loop_t>> times;
+		std::vector<unsigned> free_loops;
+		// Bodies by their hash, so that identical ones are compiled once
+		std::unordered_multimap<size_t, unsigned> loop_hashes;
+		bool loops_pending = false;
+		unsigned loops_reclaimed = 0, loops_shared = 0;
+		uint64_t loop_bytes_reclaimed = 0;
+		std::list<std::tuple<unsigned, std::string, std::string>> compile_loops;
 		std::unordered_map<std::string, function_t> functions;
+		// Opted into by memo, for functions found pure
+		std::unordered_map<std::string, memo_table> memos;
+		// Arguments of the remembered calls running, then the results being stored
+		std::vector<number_t> memo_keys;
 		std::unordered_map<std::string, number_t> variables {{
 				{"pi", 3.141592653589793238L},
 				{"e", 2.718281828459045235L}
@@ -117,82 +149,286 @@ namespace wc
 		};
 		std::list<std::tuple<scope_type, decltype(variables)>> variables_local;
 
-		std::list<unsigned> current_eval_times;
+		// Global variables of defvar, computed again from their expression when
+		// read after anything they depend on changed
+		struct derived_t {
+			stack_t body;
+			locations_t lines;
+			std::vector<std::string> inputs;
+			uint64_t epoch = 0;
+			bool stale = true;
+		};
+		std::unordered_map<std::string, derived_t> derived;
+		// Derived variables by the variables they read
+		std::unordered_map<std::string, std::vector<std::string>> dependents;
+		unsigned stale_derived = 0;
+
+		struct frame_t {
+			const stack_t* body;
+			const locations_t* lines;
+			size_t pc;
+			frame_type type;
+			unsigned remaining;
+			std::string name;
+			bool checked;
+			uint64_t profiled;
+			memo_table* memo = nullptr;
+			size_t memo_key = 0;
+		};
+		std::vector<frame_t> frames;
+
 		std::string current_eval_function;
+		// Of the line being parsed or evaluated outside of any frame
+		location_t location;
+		philox4x32 rng;
+		uint64_t rng_seed = 0, rng_stream = 0, rng_forks = 0;
+		uint64_t definitions = 1;
 		bool verbose = false, suppress_verbose = false;
+		// Whether operations record what they do, for --verbose or --trace
+		bool tracing = false;
+		std::shared_ptr<trace_ring> trace_out;
+		std::string trace_path;
 		bool is_prefix = false;
+		bool is_async_io = false;
+		// Numbers that top and batches print go out as 8-byte doubles
+		bool raw_output = false;
+
+		unsigned jobs = 0;
+		std::unique_ptr<thread_pool> pool;
+		std::vector<std::unique_ptr<wtf_calculator>> pool_workers;
+		const wtf_calculator* library = nullptr;
+		// With --watch, the files read so far in the order they were first read
+		std::unique_ptr<file_watch> watcher;
+		std::vector<watched_file_t> watched;
+		std::string* capture = nullptr;
+		// Instructions the evaluator has stepped through, and the count at which
+		// it next looks at the budgets, the memory held and for an interrupt
+		uint64_t steps = 0, next_check = UINT64_MAX;
+		// Checked every 64Ki instructions with --max-memory only, as it walks everything held
+		uint64_t max_memory = 0, memory_peak = 0;
+		bool track_memory = false;
+		// Per line evaluated or --batch record; none when 0
+		uint64_t max_steps = 0, step_limit = UINT64_MAX;
+		std::chrono::nanoseconds timeout {0};
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		bool budgeted = false;
+		// Raised by Ctrl-C while the REPL evaluates a line, and seen by the workers of its loops
+		const std::atomic<bool>* interrupt = nullptr;
 
 		bool is_time = false;
 		std::chrono::high_resolution_clock::time_point tp_begin;
+		// Set by the command line; splits lines into phases with --time or --perf-counters
+		std::unique_ptr<timing> timer;
+		std::string counters_path;
+
+		// Only set with --profile; the evaluator checks for it once per operation
+		std::unique_ptr<profiler> profile;
+		std::string profile_path;
+		std::unique_ptr<sampler> sampling;
+		std::string sample_path;
+		unsigned sample_hz = 997;
 
 	private:
-		static void op_add(wtf_calculator* ins);
-		static void op_subtract(wtf_calculator* ins);
-		static void op_multiply(wtf_calculator* ins);
-		static void op_divide(wtf_calculator* ins);
-		static void op_power(wtf_calculator* ins);
-
-		static void op_replace(wtf_calculator* ins);
-		static void op_swap(wtf_calculator* ins);
-		static void op_pop(wtf_calculator* ins);
-		static void op_top(wtf_calculator* ins);
-		static void op_topb(wtf_calculator* ins);
-
-		static void op_neg(wtf_calculator* ins);
-		static void op_sin(wtf_calculator* ins);
-		static void op_cos(wtf_calculator* ins);
-		static void op_floor(wtf_calculator* ins);
-		static void op_ceil(wtf_calculator* ins);
-
-		static void op_help(wtf_calculator* ins);
-		static void op_stack(wtf_calculator* ins);
-		static void op_quit(wtf_calculator* ins);
-		static void op_clear(wtf_calculator* ins);
-		static void op_file(wtf_calculator* ins);
-		static void op__view(wtf_calculator* ins);
-
-		static void op_var(wtf_calculator* ins);
-		static void op_set(wtf_calculator* ins);
-		static void op_varg(wtf_calculator* ins);
-		static void op_vars(wtf_calculator* ins);
-		static void op_del(wtf_calculator* ins);
-		static void op_delall(wtf_calculator* ins);
-
-		static void op_defun(wtf_calculator* ins);
-		static void op_end(wtf_calculator* ins);
-		static void op_desc(wtf_calculator* ins);
-		static void op_funcs(wtf_calculator* ins);
-		static void op__push_locals(wtf_calculator* ins);
-		static void op__pop_locals(wtf_calculator* ins);
-
-		static void op_times(wtf_calculator* ins);
-		static void op_loops(wtf_calculator* ins);
-		static void op_desc_loop(wtf_calculator* ins);
-		static void op_end_times(wtf_calculator* ins);
-		static void op__use_times(wtf_calculator* ins);
-
-		static void op_noverbose(wtf_calculator* ins);
-		static void op_verbose(wtf_calculator* ins);
-
-		static void op_print(wtf_calculator* ins);
-		static void op_println(wtf_calculator* ins);
+		static result<> op_add(wtf_calculator* ins);
+		static result<> op_subtract(wtf_calculator* ins);
+		static result<> op_multiply(wtf_calculator* ins);
+		static result<> op_divide(wtf_calculator* ins);
+		static result<> op_power(wtf_calculator* ins);
+
+		static result<> op_replace(wtf_calculator* ins);
+		static result<> op_swap(wtf_calculator* ins);
+		static result<> op_pop(wtf_calculator* ins);
+		static result<> op_top(wtf_calculator* ins);
+		static result<> op_topb(wtf_calculator* ins);
+
+		static result<> op_less(wtf_calculator* ins);
+		static result<> op_greater(wtf_calculator* ins);
+		static result<> op_less_equal(wtf_calculator* ins);
+		static result<> op_greater_equal(wtf_calculator* ins);
+		static result<> op_equal(wtf_calculator* ins);
+		static result<> op_not_equal(wtf_calculator* ins);
+
+		static result<> op_neg(wtf_calculator* ins);
+		static result<> op_abs(wtf_calculator* ins);
+		static result<> op_sin(wtf_calculator* ins);
+		static result<> op_cos(wtf_calculator* ins);
+		static result<> op_floor(wtf_calculator* ins);
+		static result<> op_ceil(wtf_calculator* ins);
+
+		static result<> op_rand(wtf_calculator* ins);
+		static result<> op_randn(wtf_calculator* ins);
+		static result<> op_randv(wtf_calculator* ins);
+		static result<> op_seed(wtf_calculator* ins);
+
+		static result<> op_help(wtf_calculator* ins);
+		static result<> op_stack(wtf_calculator* ins);
+		static result<> op_quit(wtf_calculator* ins);
+		static result<> op_clear(wtf_calculator* ins);
+		static result<> op_file(wtf_calculator* ins);
+		static result<> op__view(wtf_calculator* ins);
+
+		static result<> op_var(wtf_calculator* ins);
+		static result<> op_set(wtf_calculator* ins);
+		static result<> op_varg(wtf_calculator* ins);
+		static result<> op_vars(wtf_calculator* ins);
+		static result<> op_del(wtf_calculator* ins);
+		static result<> op_delall(wtf_calculator* ins);
+		static result<> op_defvar(wtf_calculator* ins);
+
+		static result<> op_defun(wtf_calculator* ins);
+		static result<> op_end(wtf_calculator* ins);
+		static result<> op_desc(wtf_calculator* ins);
+		static result<> op_funcs(wtf_calculator* ins);
+		static result<> op_memo(wtf_calculator* ins);
+		static result<> op__push_locals(wtf_calculator* ins);
+		static result<> op__pop_locals(wtf_calculator* ins);
+
+		static result<> op_loops(wtf_calculator* ins);
+		static result<> op_desc_loop(wtf_calculator* ins);
+		static result<> op__use_times(wtf_calculator* ins);
+		static result<> op__use_ptimes(wtf_calculator* ins);
+		static result<> op__use_while(wtf_calculator* ins);
+		static result<> op__use_until(wtf_calculator* ins);
+		static result<> op_break_if(wtf_calculator* ins);
+
+		static result<> op_noverbose(wtf_calculator* ins);
+		static result<> op_verbose(wtf_calculator* ins);
+
+		static result<> op_print(wtf_calculator* ins);
+		static result<> op_println(wtf_calculator* ins);
+
+		static result<> op_tic(wtf_calculator* ins);
+		static result<> op_toc(wtf_calculator* ins);
+
+		static result<> op_mem(wtf_calculator* ins);
 
 	private:
 		static void show_help(char* name);
 		void parse_arguments(int argc, char** argv);
 
-		void execute();
-		void evaluate();
+		static const operation_t* find_operation(std::string_view name);
+		static std::span<const operation_t> all_operations();
+
+		result<> execute();
+		result<> evaluate(size_t frames_base);
 		bool dereference_variable(const variable_ref_t& what, number_t& out);
-		void ensure_clean_stack();
+		number_t* find_variable(const std::string& name);
+		void ensure_clean_stack(size_t frames_base);
+		void push_locals(scope_type scope, const std::string& name);
+		void pop_locals(const std::string& name);
+		void push_frame(frame_type type, const stack_t& body, const locations_t* lines, unsigned remaining,
+						std::string name, bool checked = true);
+		void pop_frame();
+		// Frames point into function bodies, which may not be replaced while one runs
+		bool is_running(const std::string& function) const;
+		result<> end_frame_iteration();
+		result<> call_profiled(operations_iter_t op);
+		void take_sample();
+		void trace(const trace_record& record);
+		void update_tracing() { tracing = (verbose || trace_out) && !suppress_verbose; }
+		static uint64_t loop_memory(const loop_t& loop);
+		memory_t memory() const;
+		result<> check_memory();
+		result<> check_limits();
+		void start_budget(uint64_t limit, std::chrono::steady_clock::time_point until);
+
+		// Budgets count from the outermost line, not per line it reads through 'file'
+		struct budget_scope {
+			wtf_calculator* ins;
+			bool outer;
+			explicit budget_scope(wtf_calculator* ins);
+			~budget_scope();
+		};
 		number_t resolve_variable_if(const element_t& e);
-
-		void parse(std::string_view what);
-		void file(std::string_view what);
-		void file(std::istream& is);
+		result<> define_variable(const std::string& name, function_t&& definition);
+		result<> link_inputs(const std::string& name);
+		void invalidate(const std::string& name);
+		result<> refresh_derived(const std::string& name);
+		void forget_derived(const std::string& name);
+
+		result<stack_t> compile(std::string_view what, bool transient = false);
+		unsigned share_loop(unsigned index, unsigned library_loops);
+		void keep_loop(unsigned index, unsigned library_loops);
+		void reclaim_loops();
+		result<> parse(std::string_view what);
+		result<> run(const stack_t& program, const std::string& name, verdict_t* verdict = nullptr);
+		bool batch_record(const stack_t& program, verdict_t& verdict, const std::string& line, size_t record,
+						  std::string& error);
+		void batch(const stack_t& program, std::istream& is);
+		void batch_parallel(const stack_t& program, std::istream& is);
+		thread_pool& prepare_workers();
+		result<> parallel_times(unsigned index, unsigned loops, const std::string& reductions);
+
+		const function_t* find_function(const std::string& name) const;
+		const function_t* find_function(const std::string& name, const verdict_t*& verdict);
+		unsigned loop_count() const;
+		bool has_loop(unsigned index) const;
+		const stack_t& loop_body(unsigned index) const;
+		const locations_t& loop_lines(unsigned index) const;
+
+		result<verdict_t> verify(const stack_t& body, frame_type type, const stack_t* entry = nullptr);
+		uint64_t stamp() const;
+		void refresh(verdict_t& verdict, const stack_t& body, frame_type type);
+		void verify_all();
+		result<> check_pure(const std::string& name, std::vector<std::string>& visiting,
+							std::vector<std::string>* reads = nullptr) const;
+		result<> check_pure(const stack_t& body, std::vector<std::unordered_set<std::string>>& scopes,
+							std::vector<std::string>& visiting, std::vector<std::string>* reads = nullptr) const;
+		result<> check_parallel(const stack_t& body, std::vector<std::unordered_set<std::string>>& scopes,
+								std::vector<std::string>& visiting, bool outermost) const;
+		result<> check_memo(const std::string& name, const verdict_t* verdict) const;
+		memo_table* find_memo(const std::string& name, const verdict_t* verdict);
+		bool recall(memo_table& memo);
+		void remember(const frame_t& frame);
+		const verdict_t* loop_verdict(unsigned index) const;
+		const verdict_t* loop_verdict(unsigned index);
+		bool entry_holds(const verdict_t* verdict) const;
+		result<> file(std::string_view what);
+		result<> file(std::istream& is, std::string_view source);
+		result<> watch_file(std::string_view what);
+		result<> run_statement(const statement_t& statement, const std::string* source);
+		std::unordered_set<std::string> callees(const std::vector<std::string>& names) const;
+		void watch();
+		void stream(std::FILE* in);
+		void serve(std::string_view path);
+		void client(std::string_view path);
 		void repl();
 
-		static void display_stack(const stack_t& what_stack);
+		void display_stack(const stack_t& what_stack);
+
+		template<typename... Args>
+		void print_out(std::format_string<Args...> fmt, Args&&... args)
+		{
+			if (capture)
+				std::format_to(std::back_inserter(*capture), fmt, std::forward<Args>(args)...);
+			else
+				standard_output().print(fmt, std::forward<Args>(args)...);
+		}
+
+		void print_number(number_t value)
+		{
+			auto& to = capture ? *capture : standard_output().pending();
+			if (raw_output)
+				append_raw(to, value);
+			else
+				append_number(to, value);
+			if (!capture)
+				standard_output().written();
+		}
+
+		template<typename... Args>
+		void println_out(std::format_string<Args...> fmt, Args&&... args)
+		{
+			print_out(fmt, std::forward<Args>(args)...);
+			print_out("\n");
+		}
+
+		explicit wtf_calculator(const wtf_calculator* library);
+
+		friend class program;
+		friend class calculator;
+		// bench/primitives.cpp times the internals one by one
+		friend class microbench;
 
 	public:
 		wtf_calculator();